@@ -10,6 +10,7 @@
 #ifndef LLVM_HYPO_CONSTFOLD_H
 #define LLVM_HYPO_CONSTFOLD_H
 
+#include "llvm/ADT/BitVector.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/IntervalMap.h"
@@ -32,14 +33,18 @@
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/Allocator.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/RecyclingAllocator.h"
 #include "llvm/Transforms/Utils/ValueMapper.h"
 
 #include <limits.h>
+#include <chrono>
 #include <string>
 #include <vector>
 
+struct stat;
+
 #define LPDEBUG(x) LLVM_DEBUG(do { printDebugHeader(dbgs()); dbgs() << ": " << x; } while(0))
 
 namespace llvm {
@@ -49,6 +54,7 @@ class PHINode;
 class NonLocalDepResult;
 class LoadInst;
 class raw_ostream;
+class MemoryBuffer;
 class ConstantInt;
 class Type;
 class Argument;
@@ -60,6 +66,7 @@ class CmpInst;
 class InlineAttempt;
 class PeelAttempt;
 class LLPEAnalysisPass;
+struct MemoryReport;
 class Function;
 class DataLayout;
 class Loop;
@@ -81,6 +88,7 @@ class ShadowLoopInvar;
 class TargetLibraryInfo;
 class ShadowBB;
 class TrackedStore;
+struct ConcreteLoopRun;
 
 #ifndef LLVM_EFFICIENT_PRINTING
 class PersistPrinter { };
@@ -359,10 +367,50 @@ struct GlobalStats {
   uint32_t threadChecks;
   uint32_t condChecks;
 
+  // Work done by the general-case loop analyser when -llpe-sparse-loop-analysis is on:
+  uint64_t loopBlocksAnalysed;
+  uint64_t loopBlocksSkipped;
+  uint64_t loopInstsEvaluated;
+  uint64_t loopInstsSkipped;
+  uint64_t loopValuesWidened;
+
+  uint32_t budgetRefusedContexts;
+
+  uint64_t shadowBlocksAllocated;
+  uint64_t shadowInstsAllocated;
+  uint64_t shadowArenaBytes;
+
+  uint64_t headerMergeCacheHits;
+  uint64_t headerMergeCacheMisses;
+
+  uint64_t loadForwardCacheHits;
+  uint64_t loadForwardCacheMisses;
+
+  uint32_t heapReclaimRuns;
+  uint64_t heapSlotsReclaimed;
+  uint64_t heapSlotsRecycled;
+  uint64_t heapSlotsTrimmed;
+
+  uint64_t nativeStringCalls;
+  uint64_t concreteLoops;
+  uint64_t concreteLoopTrips;
+  uint64_t concreteLoopsReplaced;
+
+  uint64_t compactedIterations;
+  uint64_t sharedValueSets;
+
+  uint32_t dominatorTreesBuilt;
+
 GlobalStats() : dynamicFunctions(0), dynamicContexts(0), dynamicBlocks(0), dynamicInsts(0),
     disabledContexts(0), resolvedBranches(0), constantInstructions(0), pointerInstructions(0),
     setInstructions(0), unknownInstructions(0), deadInstructions(0), residualBlocks(0),
-    residualInstructions(0), mallocChecks(0), fileChecks(0), threadChecks(0), condChecks(0) {}
+    residualInstructions(0), mallocChecks(0), fileChecks(0), threadChecks(0), condChecks(0),
+    loopBlocksAnalysed(0), loopBlocksSkipped(0), loopInstsEvaluated(0), loopInstsSkipped(0), loopValuesWidened(0),
+    budgetRefusedContexts(0), shadowBlocksAllocated(0), shadowInstsAllocated(0), shadowArenaBytes(0),
+    headerMergeCacheHits(0), headerMergeCacheMisses(0), loadForwardCacheHits(0), loadForwardCacheMisses(0), heapReclaimRuns(0), heapSlotsReclaimed(0),
+    heapSlotsRecycled(0), heapSlotsTrimmed(0), nativeStringCalls(0), concreteLoops(0),
+    concreteLoopTrips(0), concreteLoopsReplaced(0), compactedIterations(0), sharedValueSets(0),
+    dominatorTreesBuilt(0) {}
 
   void print(raw_ostream& Out) {
 
@@ -383,11 +431,69 @@ GlobalStats() : dynamicFunctions(0), dynamicContexts(0), dynamicBlocks(0), dynam
     Out << "File checks: " << fileChecks << "\n";
     Out << "Thread checks: " << threadChecks << "\n";
     Out << "Cond checks: " << condChecks << "\n";
+    Out << "Loop blocks re-analysed: " << loopBlocksAnalysed << "\n";
+    Out << "Loop blocks skipped: " << loopBlocksSkipped << "\n";
+    Out << "Loop instructions re-evaluated: " << loopInstsEvaluated << "\n";
+    Out << "Loop instructions skipped: " << loopInstsSkipped << "\n";
+    Out << "Loop values widened: " << loopValuesWidened << "\n";
+    Out << "Contexts refused by budget: " << budgetRefusedContexts << "\n";
+    Out << "Shadow blocks allocated: " << shadowBlocksAllocated << "\n";
+    Out << "Shadow instructions allocated: " << shadowInstsAllocated << "\n";
+    Out << "Shadow arena bytes: " << shadowArenaBytes << "\n";
+    Out << "Loop header merge cache hits: " << headerMergeCacheHits << "\n";
+    Out << "Loop header merge cache misses: " << headerMergeCacheMisses << "\n";
+    Out << "Load forward cache hits: " << loadForwardCacheHits << "\n";
+    Out << "Load forward cache misses: " << loadForwardCacheMisses << "\n";
+    Out << "Heap reclamation runs: " << heapReclaimRuns << "\n";
+    Out << "Heap slots reclaimed: " << heapSlotsReclaimed << "\n";
+    Out << "Heap slots recycled: " << heapSlotsRecycled << "\n";
+    Out << "Heap slots trimmed: " << heapSlotsTrimmed << "\n";
+    Out << "Native string calls: " << nativeStringCalls << "\n";
+    Out << "Concrete loops: " << concreteLoops << " (" << concreteLoopTrips << " trips, " << concreteLoopsReplaced << " replaced)\n";
+    Out << "Compacted loop iterations: " << compactedIterations << " (" << sharedValueSets << " value sets shared)\n";
+    Out << "Dominator trees built: " << dominatorTreesBuilt << "\n";
 
   }
 
 };
 
+struct LoopConvergenceStats {
+
+  uint32_t analyses;
+  uint64_t totalIterations;
+  uint64_t maxIterations;
+
+LoopConvergenceStats() : analyses(0), totalIterations(0), maxIterations(0) {}
+
+};
+
+// A load's last result during a loop analysis session, valid while it reads from the same pointer
+// and the target object's LocStore keeps the same version. Owns result.
+struct LoadForwardCacheEntry {
+
+  ImprovedVal ptr;
+  uint64_t version;
+  Type* loadType;
+  bool notedDependency;
+  ImprovedValSet* result;
+
+LoadForwardCacheEntry() : version(0), loadType(0), notedDependency(false), result(0) {}
+
+};
+
+// The last latch / preheader store merge performed at a loop header. The inputs are recognised by
+// address and version and are not referenced; mergedStore is only kept, with a reference, once the
+// same inputs have turned up a second time.
+struct HeaderMergeCacheEntry {
+
+  OrdinaryLocalStore* latchStore;
+  uint64_t latchVersion;
+  OrdinaryLocalStore* preheaderStore;
+  uint64_t preheaderVersion;
+  OrdinaryLocalStore* mergedStore;
+
+};
+
 struct ArgStore {
 
   uint32_t heapIdx;
@@ -421,9 +527,14 @@ class LLPEAnalysisPass : public ModulePass {
 
    InlineAttempt* RootIA;
 
+   // Filled in the first time a global is printed; see populateGVCaches.
+   bool gvCachesPopulated;
    DenseMap<const GlobalVariable*, std::string> GVCache;
    DenseMap<const GlobalVariable*, std::string> GVCacheBrief;
 
+   // Constant globals holding file contents emitted by commit, shared between reads of the same bytes.
+   DenseMap<Constant*, GlobalVariable*> fileByteGlobals;
+
    DenseMap<const Function*, DenseMap<const Value*, std::string>* > functionTextCache;
    DenseMap<const Function*, DenseMap<const Value*, std::string>* > briefFunctionTextCache;
 
@@ -441,6 +552,7 @@ class LLPEAnalysisPass : public ModulePass {
    // Pass identifier
    static char ID;
 
+   // Built the first time a function is entered; see getDominatorTree.
    DenseMap<Function*, DominatorTree*> DTs;
 
    ImprovedValSetMulti::MapTy::Allocator IMapAllocator;
@@ -489,9 +601,28 @@ class LLPEAnalysisPass : public ModulePass {
    ShadowGV* shadowGlobals;
 
    std::vector<AllocData> heap;
+
+   // Heap slot reclamation (see HeapReclaim.cpp). Slots below heapReclaimFloor predate specialisation
+   // and are never reclaimed; freeHeapSlots holds reusable slots, lowest index last.
+   uint32_t heapReclaimFloor;
+   std::vector<uint32_t> freeHeapSlots;
+   std::vector<WeakVH> reclaimedHeapAllocations;
+   uint32_t callsSinceHeapReclaim;
+   void noteCallCommitted();
+   void reclaimHeapSlots();
+
+   // Memory usage snapshots, appended as JSON lines to -llpe-memory-report (see MemoryReport.cpp).
+   bool memoryReportStarted;
+   uint32_t callsSinceMemoryReport;
+   void noteMemoryReportPoint();
+   void writeMemoryReport(const char* reason);
+   void dumpMemoryUsage();
    std::vector<FDGlobalState> fds;
 
    RecyclingAllocator<BumpPtrAllocator, ImprovedValSetSingle> IVSAllocator;
+   // One immutable overdef set per ValSetType, standing in for the many identical results
+   // held by compacted loop iterations. Never freed; see isSharedIVS.
+   ImprovedValSetSingle sharedOverdefIVS[ValSetTypeOldOverdef + 1];
 
    bool verboseOverdef;
    bool enableSharing;
@@ -504,6 +635,13 @@ class LLPEAnalysisPass : public ModulePass {
    std::string llioConfigFile;
    std::vector<std::string> llioDependentFiles;
 
+   // Files read at specialisation time that aren't watched at runtime (e.g. --spec-argv),
+   // and the state of the on-disk analysis cache (see AnalysisCache.cpp):
+   std::vector<std::string> specInputFiles;
+   std::string analysisCacheKey;
+   Module* cachedModule;
+   Module* cacheTargetModule;
+
    DenseSet<ShadowInstruction*> barrierInstructions;
 
    bool programSingleThreaded;
@@ -512,6 +650,61 @@ class LLPEAnalysisPass : public ModulePass {
 
    DenseSet<std::pair<IntegrationAttempt*, const ShadowLoopInvar*> > latchStoresRetained;
 
+   // Number of general-case loop analyses (analyseLoop calls) in progress. State below is
+   // session-scoped: it is discarded when the outermost such analysis finishes.
+   uint32_t loopAnalyserDepth;
+
+   // Sparse general-case loop analysis: during a session values record the clock tick at which
+   // they last changed and pure instructions the tick at which they were last evaluated,
+   // so that instructions whose operands have not changed since can be skipped.
+   bool sparseLoopAnalysis;
+   uint64_t sparseLoopClock;
+   DenseMap<ShadowValue, uint64_t> sparseLastChanged;
+   DenseMap<ShadowInstruction*, uint64_t> sparseLastEval;
+
+   bool inSparseLoopSession() {
+     return sparseLoopAnalysis && loopAnalyserDepth;
+   }
+
+   // Load forwarding cache (-llpe-load-forward-cache), also session-scoped.
+   bool loadForwardCaching;
+   DenseMap<ShadowInstruction*, LoadForwardCacheEntry> loadForwardCache;
+
+   bool inLoadCacheSession() {
+     return loadForwardCaching && loopAnalyserDepth;
+   }
+
+   void clearLoadForwardCache() {
+     for(DenseMap<ShadowInstruction*, LoadForwardCacheEntry>::iterator it = loadForwardCache.begin(),
+	   itend = loadForwardCache.end(); it != itend; ++it)
+       deleteIV(it->second.result);
+     loadForwardCache.clear();
+   }
+
+   void noteValueChanged(ShadowValue V) {
+     if(inSparseLoopSession())
+       sparseLastChanged[V] = ++sparseLoopClock;
+   }
+
+   void noteValueEvaluated(ShadowInstruction* SI) {
+     if(inSparseLoopSession())
+       sparseLastEval[SI] = ++sparseLoopClock;
+   }
+
+   // Widening: a scalar value that grows loopWidenThreshold times during one session becomes overdef.
+   // Zero disables widening.
+   uint32_t loopWidenThreshold;
+   DenseMap<ShadowValue, uint32_t> loopGrowthSteps;
+
+   // Iterations-to-convergence of the general-case analysis, per loop header.
+   DenseMap<BasicBlock*, LoopConvergenceStats> loopConvergence;
+   void printLoopConvergence(raw_ostream&);
+
+   // Memoised loop header store merges (-llpe-header-merge-cache), per context and loop, for the duration of a session.
+   bool headerMergeCaching;
+   DenseMap<std::pair<IntegrationAttempt*, const ShadowLoopInvar*>, HeaderMergeCacheEntry> headerMergeCache;
+   void releaseHeaderMerge(IntegrationAttempt*, const ShadowLoopInvar*);
+
    GlobalStats stats;
 
    DenseMap<IntegrationAttempt*, std::string> shortHeaders;
@@ -529,15 +722,51 @@ class LLPEAnalysisPass : public ModulePass {
    DISubroutineType* fakeDebugType;
 
    std::string statsFile;
+
+   // Analysis budget: limits on context count, wall time (seconds) and malloc'd memory (bytes),
+   // any of which may be zero for no limit. benefitHistory records the summed integration goodness
+   // and number of finished contexts per function or loop header. See IntBenefit.cpp.
    unsigned maxContexts;
+   double timeBudget;
+   uint64_t memoryBudget;
+   std::chrono::steady_clock::time_point analysisStart;
+   bool budgetExhaustedNoted;
+   DenseMap<const Value*, std::pair<int64_t, uint32_t> > benefitHistory;
+
+   double budgetPressure();
+   bool budgetAllowsContext(const Value* Key, bool certainPath);
+   void noteContextBenefit(const Value* Key, int64_t goodness);
 
    explicit LLPEAnalysisPass() : ModulePass(ID), cacheDisabled(false) { 
 
      mallocAlignment = 0;
+     RootIA = 0;
+     cachedModule = 0;
+     cacheTargetModule = 0;
+     loopAnalyserDepth = 0;
+     sparseLoopAnalysis = false;
+     loadForwardCaching = false;
+     headerMergeCaching = false;
+     sparseLoopClock = 0;
+     loopWidenThreshold = 0;
+     timeBudget = 0;
+     memoryBudget = 0;
+     budgetExhaustedNoted = false;
+     heapReclaimFloor = 0;
+     callsSinceHeapReclaim = 0;
+     memoryReportStarted = false;
+     callsSinceMemoryReport = 0;
+     gvCachesPopulated = false;
+
+     for(uint32_t i = 0; i != ValSetTypeOldOverdef + 1; ++i) {
+       sharedOverdefIVS[i].SetType = (ValSetType)i;
+       sharedOverdefIVS[i].Overdef = true;
+     }
 
    }
 
    bool runOnModule(Module& Ms);
+   DominatorTree* getDominatorTree(Function*);
 
    void print(raw_ostream &OS, const Module* M) const;
 
@@ -639,6 +868,16 @@ class LLPEAnalysisPass : public ModulePass {
    int64_t parsePCInst(BasicBlock* bb, Module* M, std::string& instIndexStr);
    void writeLliowdConfig();
 
+   bool lookupAnalysisCache(Module&);
+   void applyAnalysisCache();
+   void storeAnalysisCache(Module&);
+
+   std::string commitOutputFile;
+   bool commitServerEnabled();
+   void runCommitServer();
+   void parseCommitArgs();
+   void writeCommitServerOutput(Module&);
+
    void initMRInfo(Module*);
    IHPFunctionInfo* getMRInfo(Function*);
 
@@ -704,8 +943,17 @@ inline ImprovedValSetSingle* newOverdefIVS() {
 
 }
 
+inline bool isSharedIVS(const ImprovedValSetSingle* I) {
+
+  return I >= GlobalIHP->sharedOverdefIVS && I < GlobalIHP->sharedOverdefIVS + (ValSetTypeOldOverdef + 1);
+
+}
+
 inline void deleteIVS(ImprovedValSetSingle* I) {
 
+  if(isSharedIVS(I))
+    return;
+
   I->~ImprovedValSetSingle();
   GlobalIHP->IVSAllocator.Deallocate(I);
 
@@ -792,15 +1040,22 @@ raw_ostream& operator<<(raw_ostream&, const IntegrationAttempt&);
 struct PartialVal {
 
   uint64_t* partialBuf;
-  bool* partialValidBuf;
+  // One bit per byte of partialBuf, set once that byte is defined.
+  uint64_t* partialValidMask;
   uint64_t partialBufBytes;
+  uint64_t validBytes;
   bool loadFinished;
 
   bool addPartialVal(PartialVal& PV, const DataLayout* TD, std::string* error);
   bool isComplete();
+  bool isValid(uint64_t i) const {
+    return (partialValidMask[i / 64] >> (i % 64)) & 1;
+  }
+  void markValid(uint64_t FirstDef, uint64_t FirstNotDef);
   void combineWith(uint8_t* Other, uint64_t FirstDef, uint64_t FirstNotDef);
   void combineWith(PartialVal& Other, uint64_t FirstDef, uint64_t FirstNotDef);
   bool combineWith(Constant* C, uint64_t ConstOffset, uint64_t FirstDef, uint64_t FirstNotDef, std::string* error);
+  void combineWithSplat(uint8_t SplatVal, uint64_t FirstDef, uint64_t FirstNotDef);
   
   PartialVal(uint64_t nBytes);
   PartialVal(const PartialVal& Other);
@@ -837,16 +1092,18 @@ inline bool operator==(const ImprovedValSetSingle& PB1, const ImprovedValSetSing
   if(PB1.Values.size() != PB2.Values.size())
     return false;
 
-  // These are sets, so changing the order like this is acceptable
-  ImprovedValSetSingle* MPB1 = const_cast<ImprovedValSetSingle*>(&PB1);
-  ImprovedValSetSingle* MPB2 = const_cast<ImprovedValSetSingle*>(&PB2);
+  // By far the most common case:
+  if(PB1.Values.size() == 1)
+    return PB1.Values[0] == PB2.Values[0];
 
-  std::sort(MPB1->Values.begin(), MPB1->Values.end());
-  std::sort(MPB2->Values.begin(), MPB2->Values.end());
-
-  for(unsigned i = 0; i < PB1.Values.size(); ++i)
-    if(PB1.Values[i] != PB2.Values[i])
+  // These are sets of at most PBMAX members, so mutual inclusion is cheaper than sorting both
+  // and leaves the operands untouched.
+  for(unsigned i = 0; i < PB1.Values.size(); ++i) {
+    if(std::find(PB2.Values.begin(), PB2.Values.end(), PB1.Values[i]) == PB2.Values.end())
+      return false;
+    if(std::find(PB1.Values.begin(), PB1.Values.end(), PB2.Values[i]) == PB1.Values.end())
       return false;
+  }
 
   return true;
 
@@ -996,6 +1253,25 @@ enum CommitState {
 
 };
 
+// What a loop run by runLoopConcretely leaves behind: the values its exit PHIs take, and the
+// bytes it wrote, which are written in its place in the committed program if we can drop it.
+struct ConcreteLoopResult {
+
+  uint32_t exitFrom;
+  uint32_t exitTo;
+  // Exit block instruction index -> final value of its in-loop operand.
+  SmallVector<std::pair<uint32_t, ImprovedValSetSingle>, 4> exitPHIValues;
+  // Each run of bytes the loop wrote, and its final contents.
+  std::vector<std::pair<ImprovedVal, Constant*> > writes;
+  // False if code after the loop uses an in-loop value we don't know.
+  bool canReplace;
+  // Straight-line block standing in for the loop, if commitCFG chose to drop it.
+  BasicBlock* commitBlock;
+
+ConcreteLoopResult(uint32_t from, uint32_t to) : exitFrom(from), exitTo(to), canReplace(true), commitBlock(0) { }
+
+};
+
 class IntegrationAttempt {
 
 protected:
@@ -1026,6 +1302,11 @@ protected:
   // within the invar info.
   uint32_t BBsOffset;
 
+  // Backing memory for our ShadowBBs, their successor flags and instruction shadows,
+  // all released at once when the context's memory is freed. Loop iterations use their
+  // PeelAttempt's arena instead; see getShadowArena.
+  BumpPtrAllocator shadowArena;
+
   ShadowFunctionInvar* invarInfo;
 
   int64_t totalIntegrationGoodness;
@@ -1033,6 +1314,7 @@ protected:
   uint64_t residualInstructionsHere;
 
   DenseMap<const ShadowLoopInvar*, PeelAttempt*> peelChildren;
+  DenseMap<const ShadowLoopInvar*, ConcreteLoopResult*> concreteLoops;
 
   uint32_t pendingEdges;
 
@@ -1128,6 +1410,9 @@ protected:
   ShadowBBInvar* getBBInvar(uint32_t idx) const;
   ShadowBB* createBB(uint32_t blockIdx);
   ShadowBB* createBB(ShadowBBInvar*);
+  void freeBB(ShadowBB*);
+  void releaseShadowArena();
+  virtual BumpPtrAllocator& getShadowArena() { return shadowArena; }
   ShadowInstructionInvar* getInstInvar(uint32_t blockidx, uint32_t instidx);
   virtual ShadowInstruction* getInstFalling(ShadowBBInvar* BB, uint32_t instIdx) = 0;
   ShadowInstruction* getInst(uint32_t blockIdx, uint32_t instIdx);
@@ -1140,6 +1425,13 @@ protected:
   bool analyseBlockInstructions(ShadowBB* BB, bool inLoopAnalyser, bool inAnyLoop);
   bool analyseInstruction(ShadowInstruction* SI, bool inLoopAnalyser, bool inAnyLoop, bool& loadedVarargsHere, bool& bail);
   bool analyseLoop(const ShadowLoopInvar*, bool nestedLoop);
+  ConcreteLoopRun* runLoopConcretely(const ShadowLoopInvar*);
+  void applyConcreteLoopRun(ConcreteLoopRun*);
+  ConcreteLoopResult* getConcreteLoopResult(const ShadowLoopInvar*);
+  bool tryEvaluateConcreteExitPHI(ShadowInstruction* SI, ImprovedValSet*& NewPB);
+  bool canReplaceConcreteLoop(const ShadowLoopInvar*, ConcreteLoopResult*);
+  void releaseConcreteLoopResults();
+  void mergeLoopHeaderStores(const ShadowLoopInvar*, ShadowBB* LBB, ShadowBB* PHBB, ShadowBB* HBB);
   void releaseLatchStores(const ShadowLoopInvar*);
   virtual void getInitialStore(bool inLoopAnalyser) = 0;
   // Toplevel, execute-only version:
@@ -1195,7 +1487,7 @@ protected:
 
   InlineAttempt* getInlineAttempt(ShadowInstruction* CI) {
     // Only calls and invokes use tSD at the moment, so no need for a check.
-    return (InlineAttempt*)CI->typeSpecificData;
+    return (InlineAttempt*)CI->getTypeSpecificData();
   }
   virtual bool stackIncludesCallTo(Function*) = 0;
   bool shouldInlineFunction(ShadowInstruction*, Function*);
@@ -1357,6 +1649,8 @@ protected:
   bool trySynthArg(ShadowArg* A, BasicBlock* emitBB, Value*& Result);
   void emitOrSynthInst(ShadowInstruction* I, ShadowBB* BB, SmallVector<CommittedBlock, 1>::iterator& emitBB);
   void commitLoopInstructions(const ShadowLoopInvar* ScopeL, uint32_t& i);
+  void populateSkippedLoopFailedBlocks(const ShadowLoopInvar* ScopeL, uint32_t& i);
+  void commitConcreteLoop(ConcreteLoopResult*);
   void commitInstructions();
   bool isCommitted() { 
     return commitState == COMMIT_DONE || commitState == COMMIT_FREED;
@@ -1478,7 +1772,7 @@ protected:
     printHeader(Str);
   }
 
-  void dumpMemoryUsage(int indent = 0);
+  uint64_t dumpMemoryUsage(raw_ostream& Out, MemoryReport& Report);
 
 };
 
@@ -1549,6 +1843,8 @@ public:
   void dropExitingStoreRef(uint32_t, uint32_t);
 
   void prepareShadows();
+  virtual BumpPtrAllocator& getShadowArena();
+  void compactValues();
   virtual std::string getCommittedBlockPrefix();
   virtual BasicBlock* getSuccessorBB(ShadowBB* BB, uint32_t succIdx, bool& markUnreachable);
   virtual void emitPHINode(ShadowBB* BB, ShadowInstruction* I, BasicBlock* emitBB);
@@ -1607,6 +1903,9 @@ class PeelAttempt {
    bool integrationGoodnessValid;
 
    std::vector<PeelIteration*> Iterations;
+   // Shared by all iterations' shadow blocks, so a long run of small iterations doesn't
+   // leave a mostly-empty slab behind each one.
+   BumpPtrAllocator iterationArena;
    std::vector<BasicBlock*> CommitBlocks;
    std::vector<BasicBlock*> CommitFailedBlocks;
    std::vector<Function*> CommitFunctions;
@@ -1637,7 +1936,7 @@ class PeelAttempt {
    bool isEnabled(); 
    void setEnabled(bool, bool skipStats); 
    
-   void dumpMemoryUsage(int indent); 
+   uint64_t dumpMemoryUsage(raw_ostream& Out, MemoryReport& Report);
 
    int64_t getResidualInstructions(); 
    void findProfitableIntegration();
@@ -1931,7 +2230,7 @@ IAIterator(const IAIterator& other) : parent(other.parent), blockIdx(other.block
       
 	for(; instIdx < parent->BBs[blockIdx]->insts.size(); ++instIdx) {
 	  
-	  if(parent->BBs[blockIdx]->insts[instIdx].typeSpecificData)
+	  if(parent->BBs[blockIdx]->insts[instIdx].getTypeSpecificData())
 	    return;
 	  
 	}
@@ -1973,7 +2272,7 @@ IAIterator(const IAIterator& other) : parent(other.parent), blockIdx(other.block
 
     release_assert(blockIdx < parent->nBBs);
     ShadowInstruction* SI = &parent->BBs[blockIdx]->insts[instIdx];
-    D = std::make_pair(SI, (InlineAttempt*)SI->typeSpecificData);
+    D = std::make_pair(SI, (InlineAttempt*)SI->getTypeSpecificData());
     return D;
     
   }
@@ -2029,7 +2328,12 @@ inline IntegrationAttempt* ShadowValue::getCtx() const {
  Constant* intFromBytes(const uint64_t*, unsigned, unsigned, llvm::LLVMContext&);
  
  // Implemented in Transforms/Integrator/SimpleVFSEval.cpp, so only usable with -integrator
- bool getFileBytes(std::string& strFileName, uint64_t realFilePos, uint64_t realBytes, std::vector<Constant*>& arrayBytes, LLVMContext& Context, std::string& errors);
+ int statCachedFile(const std::string& strFileName, struct stat* st);
+ void getSnapshotFiles(std::vector<std::string>& Names);
+ void clearFileSnapshots();
+ uint64_t getResidentBytes();
+ const MemoryBuffer* getFileSnapshot(const std::string& strFileName, std::string& errors);
+ Constant* getFileBytes(std::string& strFileName, uint64_t realFilePos, uint64_t realBytes, LLVMContext& Context, std::string& errors);
 
  // Implemented in VMCore/AsmWriter.cpp, since that file contains a bunch of useful private classes
  // if LLVM has been patched appropriately; otherwise stubbed out with simple implementations in Print.cpp.
@@ -2106,7 +2410,7 @@ inline IntegrationAttempt* ShadowValue::getCtx() const {
 
  Constant* PVToConst(PartialVal& PV, uint64_t Size, LLVMContext&);
 
- bool doBlockStoreMerge(ShadowBB* BB);
+ bool doBlockStoreMerge(ShadowBB* BB, SmallVectorImpl<ShadowBB*>* incomingBlocks = 0);
  void doCallStoreMerge(ShadowInstruction* SI);
  void doCallStoreMerge(ShadowBB* BB, InlineAttempt* IA);
 
@@ -2114,6 +2418,9 @@ inline IntegrationAttempt* ShadowValue::getCtx() const {
  void doCallFDStoreMerge(ShadowBB* BB, InlineAttempt* IA);
 
  void initSpecialFunctionsMap(Module& M);
+ void initStringFunctionsMap(Module& M);
+ bool isStringFunction(Function* F);
+ bool tryEvaluateStringCall(ShadowInstruction* SI);
  
  void printPB(raw_ostream& out, ImprovedValSetSingle PB, bool brief = false);
 
@@ -2144,6 +2451,7 @@ inline IntegrationAttempt* ShadowValue::getCtx() const {
 
  void clearAsExpectedChecks(ShadowBB*);
  void noteLLIODependency(std::string&);
+ bool getFileSha1(const std::string& Filename, unsigned char* hash);
 
  const GlobalValue* getUnderlyingGlobal(const GlobalValue* V);
 
@@ -2169,10 +2477,10 @@ inline IntegrationAttempt* ShadowValue::getCtx() const {
  void noteBarrierInst(ShadowInstruction*);
  void executeSameObject(ShadowInstruction*);
 
- void doTLStoreMerge(ShadowBB* BB);
+ void doTLStoreMerge(ShadowBB* BB, ArrayRef<ShadowBB*> incomingBlocks = None);
  void doTLCallMerge(ShadowBB* BB, InlineAttempt* IA);
 
- void doDSEStoreMerge(ShadowBB* BB);
+ void doDSEStoreMerge(ShadowBB* BB, ArrayRef<ShadowBB*> incomingBlocks = None);
  void doDSECallMerge(ShadowBB* BB, InlineAttempt* IA);
 
  void TLWalkPathConditions(ShadowBB* BB, bool contextEnabled, bool secondPass);
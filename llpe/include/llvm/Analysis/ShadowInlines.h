@@ -777,9 +777,184 @@ struct HalfOpenWithMerge {
 
 };
 
+// The extent list behind an ImprovedValSetMulti. Most objects are small structs with a handful of
+// members, so their extents are kept in a sorted inline array, moving to an IntervalMap once an insert
+// finds more than SmallExtents of them. Iterators offer the subset of the IntervalMap iterator interface
+// that we use, with the same semantics: insert() inserts before the current position without searching
+// and leaves the iterator at the new extent; erase() moves it on to the next one. As with IntervalMap,
+// modifying the map through one iterator invalidates any others.
+class IVSExtentMap {
+
+public:
+
+  typedef IntervalMap<uint64_t, ImprovedValSetSingle, IntervalMapImpl::NodeSizer<uint64_t, ImprovedValSetSingle>::LeafSize, HalfOpenNoMerge> LargeMapTy;
+  typedef LargeMapTy::Allocator Allocator;
+
+  static const uint32_t SmallExtents = 8;
+
+  struct Extent {
+
+    uint64_t Start;
+    uint64_t Stop;
+    ImprovedValSetSingle Val;
+
+  Extent(uint64_t a, uint64_t b, const ImprovedValSetSingle& V) : Start(a), Stop(b), Val(V) { }
+
+  };
+
+private:
+
+  Allocator& Alloc;
+  SmallVector<Extent, 4> Small;
+  LargeMapTy* Large;
+
+  IVSExtentMap(const IVSExtentMap&) = delete;
+  IVSExtentMap& operator=(const IVSExtentMap&) = delete;
+
+  // Index of the first extent ending after x, as for IntervalMap::find.
+  uint32_t findSmall(uint64_t x) const {
+    uint32_t i = 0, ilim = Small.size();
+    while(i != ilim && Small[i].Stop <= x)
+      ++i;
+    return i;
+  }
+
+  void grow() {
+    Large = new LargeMapTy(Alloc);
+    for(uint32_t i = 0, ilim = Small.size(); i != ilim; ++i)
+      Large->insert(Small[i].Start, Small[i].Stop, Small[i].Val);
+    Small.clear();
+  }
+
+public:
+
+  template<class MapT, class LargeItT> class iterator_base {
+
+    friend class IVSExtentMap;
+
+    MapT* map;
+    uint32_t idx;
+    LargeItT largeIt;
+
+  iterator_base(MapT* M, uint32_t i) : map(M), idx(i) { }
+  iterator_base(MapT* M, const LargeItT& it) : map(M), idx(0), largeIt(it) { }
+
+  public:
+
+  iterator_base() : map(0), idx(0) { }
+
+    uint64_t start() const { return map->Large ? largeIt.start() : map->Small[idx].Start; }
+    uint64_t stop() const { return map->Large ? largeIt.stop() : map->Small[idx].Stop; }
+    const ImprovedValSetSingle& value() const { return map->Large ? largeIt.value() : map->Small[idx].Val; }
+    const ImprovedValSetSingle& operator*() const { return value(); }
+    const ImprovedValSetSingle* operator->() const { return &value(); }
+
+    bool operator==(const iterator_base& other) const {
+      if(map != other.map)
+	return false;
+      if(map && map->Large)
+	return largeIt == other.largeIt;
+      return idx == other.idx;
+    }
+    bool operator!=(const iterator_base& other) const { return !(*this == other); }
+
+    iterator_base& operator++() {
+      if(map->Large)
+	++largeIt;
+      else
+	++idx;
+      return *this;
+    }
+    iterator_base& operator--() {
+      if(map->Large)
+	--largeIt;
+      else
+	--idx;
+      return *this;
+    }
+
+    // Mutators, only available through a non-const map:
+
+    void setStart(uint64_t a) { setStartUnchecked(a); }
+    void setStop(uint64_t b) { setStopUnchecked(b); }
+
+    void setStartUnchecked(uint64_t a) {
+      if(map->Large)
+	largeIt.setStartUnchecked(a);
+      else
+	map->Small[idx].Start = a;
+    }
+    void setStopUnchecked(uint64_t b) {
+      if(map->Large)
+	largeIt.setStopUnchecked(b);
+      else
+	map->Small[idx].Stop = b;
+    }
+
+    void insert(uint64_t a, uint64_t b, const ImprovedValSetSingle& y) {
+      if(map->Large)
+	largeIt.insert(a, b, y);
+      else
+	map->Small.insert(map->Small.begin() + idx, Extent(a, b, y));
+    }
+
+    void erase() {
+      if(map->Large)
+	largeIt.erase();
+      else
+	map->Small.erase(map->Small.begin() + idx);
+    }
+
+  };
+
+  typedef iterator_base<IVSExtentMap, LargeMapTy::iterator> iterator;
+  typedef iterator_base<const IVSExtentMap, LargeMapTy::const_iterator> const_iterator;
+
+  IVSExtentMap(Allocator& A) : Alloc(A), Large(0) { }
+  ~IVSExtentMap() { delete Large; }
+
+  bool empty() const { return Large ? Large->empty() : Small.empty(); }
+  bool isSmall() const { return !Large; }
+
+  iterator begin() { return Large ? iterator(this, Large->begin()) : iterator(this, 0); }
+  iterator end() { return Large ? iterator(this, Large->end()) : iterator(this, Small.size()); }
+  iterator find(uint64_t x) { return Large ? iterator(this, Large->find(x)) : iterator(this, findSmall(x)); }
+  const_iterator begin() const { return Large ? const_iterator(this, Large->begin()) : const_iterator(this, 0); }
+  const_iterator end() const { return Large ? const_iterator(this, Large->end()) : const_iterator(this, Small.size()); }
+  const_iterator find(uint64_t x) const { return Large ? const_iterator(this, Large->find(x)) : const_iterator(this, findSmall(x)); }
+
+  // [a, b) must not overlap any existing extent.
+  void insert(uint64_t a, uint64_t b, const ImprovedValSetSingle& y) {
+    if(!Large && Small.size() >= SmallExtents)
+      grow();
+    if(Large)
+      Large->insert(a, b, y);
+    else
+      Small.insert(Small.begin() + findSmall(a), Extent(a, b, y));
+  }
+
+  void clear() {
+    Small.clear();
+    delete Large;
+    Large = 0;
+  }
+
+  // Replace our contents with a copy of other's: a flat copy unless other has grown.
+  void copyFrom(const IVSExtentMap& other) {
+    clear();
+    if(!other.Large)
+      Small = other.Small;
+    else {
+      for(const_iterator it = other.begin(), itend = other.end(); it != itend; ++it)
+	insert(it.start(), it.stop(), *it);
+    }
+  }
+
+};
+
 struct ImprovedValSetMulti : public ImprovedValSet {
 
-  typedef IntervalMap<uint64_t, ImprovedValSetSingle, IntervalMapImpl::NodeSizer<uint64_t, ImprovedValSetSingle>::LeafSize, HalfOpenNoMerge> MapTy;
+  typedef IVSExtentMap MapTy;
   typedef MapTy::iterator MapIt;
   typedef MapTy::const_iterator ConstMapIt;
   MapTy Map;
@@ -881,10 +1056,17 @@ extern LocStore NormalEmptyMapPtr;
 struct LocStore {
 
   ImprovedValSet* store;
+  // Renewed whenever store may be written; copies keep their original's version,
+  // so two LocStores with the same version have the same contents.
+  uint64_t version;
 
-LocStore(ImprovedValSet* s) : store(s) {}
-LocStore() : store(0) {}
-LocStore(const LocStore& other) : store(other.store) {}
+  static uint64_t nextVersion;
+
+LocStore(ImprovedValSet* s) : store(s), version(++nextVersion) {}
+LocStore() : store(0), version(++nextVersion) {}
+LocStore(const LocStore& other) : store(other.store), version(other.version) {}
+
+  void noteWrite() { version = ++nextVersion; }
 
   static LocStore& getEmptyStore() {
 
@@ -912,7 +1094,11 @@ LocStore(const LocStore& other) : store(other.store) {}
   void checkMergedResult() {  }
 
   // Simple forwards:
-  LocStore getReadableCopy() { return LocStore(store->getReadableCopy());  }
+  LocStore getReadableCopy() {
+    LocStore ret(store->getReadableCopy());
+    ret.version = version;
+    return ret;
+  }
   bool dropReference() {  return store->dropReference();  }
   void print(raw_ostream& RSO, bool brief) { store->print(RSO, brief); }
 
@@ -945,6 +1131,7 @@ struct AllocData {
   std::vector<std::pair<WeakVH, uint32_t> > PatchRefs;
   Type* allocType;
   Value* committedVal;
+  bool everEscaped; // Set the first time any context lets a pointer to this object escape.
 
   bool isAvailable();
 
@@ -963,17 +1150,40 @@ enum ThreadLocalState {
 #define RUNTIME_CHECK_READ_LLIOWD 2
 #define RUNTIME_CHECK_READ_MEMCMP 3
 
+// Fields of a ShadowInstruction that are only wanted for calls or at commit time. These are kept in a
+// separate per-block array (ShadowBB::instCommitData) so that analysis, DIE, DSE and statistics walks
+// over a block's instructions only pull the hot fields below through the cache.
+struct ShadowInstructionCommitData {
+
+  Value* committedVal;
+  void* typeSpecificData;
+
+};
+
 struct ShadowInstruction {
 
   ShadowBB* parent;
   ShadowInstructionInvar* invar;
   InstArgImprovement i;
-  Value* committedVal;
   // Of a load, memcpy or realloc, is there no need to check for thread interference?
   unsigned char isThreadLocal;
   unsigned char needsRuntimeCheck;
   unsigned char dieStatus;
-  void* typeSpecificData;
+
+  inline ShadowInstructionCommitData& commitData();
+
+  Value* getCommittedVal() {
+    return commitData().committedVal;
+  }
+  void setCommittedVal(Value* V) {
+    commitData().committedVal = V;
+  }
+  void* getTypeSpecificData() {
+    return commitData().typeSpecificData;
+  }
+  void setTypeSpecificData(void* D) {
+    commitData().typeSpecificData = D;
+  }
 
   void initTypeSpecificData();
 
@@ -1109,6 +1319,7 @@ struct OrdinaryStoreExtraState {
   DenseSet<ShadowValue> unescapedObjects;
 
   void copyFrom(const OrdinaryStoreExtraState& es) { *this = es; }
+  void dropDeadObjects(const BitVector& dead);
   static void doMerge(LocalStoreMap<LocStore, OrdinaryStoreExtraState>* toMap, 
 		      SmallVector<LocalStoreMap<LocStore, OrdinaryStoreExtraState>*, 4>::iterator fromBegin, 
 		      SmallVector<LocalStoreMap<LocStore, OrdinaryStoreExtraState>*, 4>::iterator fromEnd,
@@ -1205,6 +1416,7 @@ DSEMapPointer(const DSEMapPointer& other) : M(other.M), A(other.A) {}
 struct DSEStoreExtraState {
 
   void copyFrom(const DSEStoreExtraState& es) { }
+  void dropDeadObjects(const BitVector&) { }
   static void doMerge(LocalStoreMap<DSEMapPointer, DSEStoreExtraState>* toMap, 
 		      SmallVector<LocalStoreMap<DSEMapPointer, DSEStoreExtraState>*, 4>::iterator fromBegin, 
 		      SmallVector<LocalStoreMap<DSEMapPointer, DSEStoreExtraState>*, 4>::iterator fromEnd,
@@ -1265,6 +1477,7 @@ TLMapPointer(const TLMapPointer& other) : M(other.M) {}
 struct TLStoreExtraState {
 
   void copyFrom(const TLStoreExtraState& other) {  }
+  void dropDeadObjects(const BitVector&) { }
 
   static void doMerge(LocalStoreMap<TLMapPointer, TLStoreExtraState>* toMap, 
 		      SmallVector<LocalStoreMap<TLMapPointer, TLStoreExtraState>*, 4>::iterator fromBegin, 
@@ -1316,8 +1529,30 @@ struct FDStore {
 
   }
   
-FDStore() : refCount(1), fds() {}
-FDStore(const FDStore& Other) : refCount(1), fds(Other.fds) {}
+  // Every live FD store, for the memory report.
+  static FDStore* liveStores;
+  FDStore* prevLive;
+  FDStore* nextLive;
+
+FDStore() : refCount(1), fds() { link(); }
+FDStore(const FDStore& Other) : refCount(1), fds(Other.fds) { link(); }
+
+  ~FDStore() {
+    if(prevLive)
+      prevLive->nextLive = nextLive;
+    else
+      liveStores = nextLive;
+    if(nextLive)
+      nextLive->prevLive = prevLive;
+  }
+
+  void link() {
+    prevLive = 0;
+    nextLive = liveStores;
+    if(liveStores)
+      liveStores->prevLive = this;
+    liveStores = this;
+  }
 
 };
 
@@ -1354,6 +1589,8 @@ struct ShadowBB {
   bool* succsAlive;
   ShadowBBStatus status;
   ImmutableArray<ShadowInstruction> insts;
+  // Cold per-instruction data, parallel to insts.
+  ShadowInstructionCommitData* instCommitData;
 
   OrdinaryLocalStore* localStore;
   DSELocalStore* dseStore;
@@ -1365,12 +1602,7 @@ struct ShadowBB {
   bool useSpecialVarargMerge;
   bool inAnyLoop;
 
-  ~ShadowBB() {
-
-    delete[] &(insts[0]);
-    delete[] succsAlive;
-
-  }
+  // insts, instCommitData and succsAlive live in the owning context's shadow arena; see IntegrationAttempt::getShadowArena.
 
   bool isMarkedCertain() {
     return status == BBSTATUS_CERTAIN;
@@ -1467,6 +1699,12 @@ inline LocalStoreMap<LocStore, OrdinaryStoreExtraState>* LocStore::getMapForBloc
 
 }
 
+inline ShadowInstructionCommitData& ShadowInstruction::commitData() {
+
+  return parent->instCommitData[this - &(parent->insts[0])];
+
+}
+
 struct ShadowLoopInvar {
 
   uint32_t headerIdx;
@@ -1628,7 +1866,7 @@ inline LLVMContext& ShadowValue::getLLVMContext() const {
 inline void ShadowValue::setCommittedVal(Value* V) {
   switch(t) {
   case SHADOWVAL_INST:
-    u.I->committedVal = V;
+    u.I->setCommittedVal(V);
     break;
   case SHADOWVAL_ARG:
     u.A->committedVal = V;
@@ -17,25 +17,92 @@ template<class, class> class MergeBlockVisitor;
 
 template<class ChildType, class ExtraState> struct SharedTreeNode {
 
-  // These point to SharedTreeNodes or ChildTypes if this is the bottom layer.
-  void* children[HEAPTREEORDER];
+  // Children are SharedTreeNodes, or ChildTypes if this is the bottom layer.
+  // Only children that exist are stored: bit i of present is set iff child i exists, in which case
+  // it is found at slots[getSlot(i)]. Heap trees are often sparse, so this keeps nodes (and the copies
+  // made by COW breaks) proportional to the number of children rather than HEAPTREEORDER.
+  void** slots;
+  uint16_t present;
+  uint8_t capacity;
   int refCount;
 
-SharedTreeNode() : refCount(1) {
+  // COW breaks so far, for the memory report.
+  static uint64_t cowBreaks;
 
-  memset(children, 0, sizeof(void*) * HEAPTREEORDER);
+SharedTreeNode() : slots(0), present(0), capacity(0), refCount(1) { }
 
-}
+  ~SharedTreeNode() {
+
+    free(slots);
+
+  }
+
+  uint32_t getSlot(uint32_t i) const {
+    return countPopulation((uint32_t)present & ((1U << i) - 1));
+  }
 
+  uint32_t countChildren() const {
+    return countPopulation((uint32_t)present);
+  }
+
+  void* getChild(uint32_t i) const {
+    if(!(present & (1U << i)))
+      return 0;
+    return slots[getSlot(i)];
+  }
+
+  void setChild(uint32_t i, void* child);
   bool dropReference(uint32_t idx, uint32_t height, std::vector<ShadowValue>* simplified);
   ChildType* getReadableStoreFor(uint32_t idx, uint32_t height);
   ChildType* getOrCreateStoreFor(uint32_t idx, uint32_t height, bool* isNewStore);
   SharedTreeNode* getWritableNode(uint32_t height);
   void mergeHeaps(SmallVector<SharedTreeNode<ChildType, ExtraState>*, 4>& others, bool allOthersClobbered, uint32_t height, uint32_t idx, MergeBlockVisitor<ChildType, ExtraState>* visitor);
   void print(raw_ostream&, bool brief, uint32_t height, uint32_t idx);
+  bool hasDeadSlots(uint32_t idx, uint32_t height, const BitVector& dead);
+  SharedTreeNode* dropDeadSlots(uint32_t idx, uint32_t height, const BitVector& dead);
 
 };
 
+template<class ChildType, class ExtraState> uint64_t SharedTreeNode<ChildType, ExtraState>::cowBreaks = 0;
+
+// Set child i, or remove it if child is null. The node must be writable.
+template<class ChildType, class ExtraState> 
+void SharedTreeNode<ChildType, ExtraState>::setChild(uint32_t i, void* child) {
+
+  uint32_t slot = getSlot(i);
+  uint32_t n = countChildren();
+
+  if(present & (1U << i)) {
+
+    if(child) {
+      slots[slot] = child;
+    }
+    else {
+      memmove(&slots[slot], &slots[slot + 1], sizeof(void*) * (n - (slot + 1)));
+      present &= ~(1U << i);
+    }
+
+    return;
+
+  }
+
+  if(!child)
+    return;
+
+  if(n == capacity) {
+
+    capacity = capacity ? std::min(capacity * 2, HEAPTREEORDER) : 2;
+    slots = (void**)realloc(slots, sizeof(void*) * capacity);
+    release_assert(slots && "Out of memory growing heap tree node");
+
+  }
+
+  memmove(&slots[slot + 1], &slots[slot], sizeof(void*) * (n - slot));
+  slots[slot] = child;
+  present |= (1U << i);
+
+}
+
 template<class ChildType, class ExtraState> 
 bool SharedTreeNode<ChildType, ExtraState>::dropReference(uint32_t idx, uint32_t height, std::vector<ShadowValue>* simplified) {
 
@@ -51,10 +118,8 @@ bool SharedTreeNode<ChildType, ExtraState>::dropReference(uint32_t idx, uint32_t
     if(height == 0) {
 
       for(uint32_t i = 0; i < HEAPTREEORDER; ++i) {
-	if(children[i]) {
+	if(ChildType* child = (ChildType*)getChild(i)) {
 
-	  ChildType* child = ((ChildType*)children[i]);
-	  
 	  if(simplified && child->derefWillAllowSimplify())
 	    simplified->push_back(ShadowValue::getPtrIdx(-1, idx + i));
 
@@ -68,9 +133,8 @@ bool SharedTreeNode<ChildType, ExtraState>::dropReference(uint32_t idx, uint32_t
     else {
 
       for(uint32_t i = 0; i < HEAPTREEORDER; ++i) {
-	if(children[i])
-	  ((SharedTreeNode*)children[i])->dropReference(idx + (i << (height * HEAPTREEORDERLOG2)), 
-							height - 1, simplified);
+	if(SharedTreeNode* child = (SharedTreeNode*)getChild(i))
+	  child->dropReference(idx + (i << (height * HEAPTREEORDERLOG2)), height - 1, simplified);
       }
 
     }
@@ -86,21 +150,20 @@ bool SharedTreeNode<ChildType, ExtraState>::dropReference(uint32_t idx, uint32_t
 template<class ChildType, class ExtraState> 
 ChildType* SharedTreeNode<ChildType, ExtraState>::getReadableStoreFor(uint32_t idx, uint32_t height) {
 
-  uint32_t nextChild = (idx >> (height * HEAPTREEORDERLOG2)) & (HEAPTREEORDER-1);
-
-  if(!children[nextChild])
-    return 0;
+  SharedTreeNode* node = this;
 
-  if(height == 0) {
+  while(1) {
 
-    // Our children are leaves.
-    return (ChildType*)children[nextChild];
+    uint32_t nextChild = (idx >> (height * HEAPTREEORDERLOG2)) & (HEAPTREEORDER-1);
+    void* child = node->getChild(nextChild);
 
-  }
-  else {
+    // Our children are leaves, or there's nothing further down?
+    if(height == 0 || !child)
+      return (ChildType*)child;
 
     // Walk further down the tree.
-    return ((SharedTreeNode*)children[nextChild])->getReadableStoreFor(idx, height - 1);
+    node = (SharedTreeNode*)child;
+    --height;
 
   }
 
@@ -115,22 +178,25 @@ SharedTreeNode<ChildType, ExtraState>::getOrCreateStoreFor(uint32_t idx, uint32_
   
   if(height == 0) {
     
-    bool mustCreate = *isNewStore = (children[nextChild] == 0);
-    if(mustCreate)
-      children[nextChild] = new ChildType();
-    return (ChildType*)children[nextChild];
+    ChildType* child = (ChildType*)getChild(nextChild);
+    bool mustCreate = *isNewStore = (child == 0);
+    if(mustCreate) {
+      child = new ChildType();
+      setChild(nextChild, child);
+    }
+    return child;
 
   }
   else {
 
-    SharedTreeNode* child;
+    SharedTreeNode* child = (SharedTreeNode*)getChild(nextChild);
 
-    if(!children[nextChild])
+    if(!child)
       child = new SharedTreeNode();
     else
-      child = ((SharedTreeNode*)children[nextChild])->getWritableNode(height - 1);
+      child = child->getWritableNode(height - 1);
 
-    children[nextChild] = child;
+    setChild(nextChild, child);
     return child->getOrCreateStoreFor(idx, height - 1, isNewStore);
 
   }
@@ -143,26 +209,29 @@ SharedTreeNode<ChildType, ExtraState>::getWritableNode(uint32_t height) {
   if(refCount == 1)
     return this;
 
-  // COW break this node.
+  // COW break this node, copying only the children that exist.
+  ++cowBreaks;
   SharedTreeNode* newNode = new SharedTreeNode();
+  uint32_t n = countChildren();
 
-  if(height == 0) {
+  if(n) {
 
-    for(uint32_t i = 0; i < HEAPTREEORDER; ++i) {
+    newNode->slots = (void**)malloc(sizeof(void*) * n);
+    release_assert(newNode->slots && "Out of memory copying heap tree node");
+    newNode->capacity = n;
+    newNode->present = present;
 
-      if(children[i])
-	newNode->children[i] = new ChildType(((ChildType*)children[i])->getReadableCopy());
-      
-    }
+    if(height == 0) {
 
-  }
-  else {
+      for(uint32_t i = 0; i < n; ++i)
+	newNode->slots[i] = new ChildType(((ChildType*)slots[i])->getReadableCopy());
 
-    for(uint32_t i = 0; i < HEAPTREEORDER; ++i) {
+    }
+    else {
 
-      if(children[i]) {
-	((SharedTreeNode*)children[i])->refCount++;
-	newNode->children[i] = children[i];
+      for(uint32_t i = 0; i < n; ++i) {
+	((SharedTreeNode*)slots[i])->refCount++;
+	newNode->slots[i] = slots[i];
       }
 
     }
@@ -176,47 +245,27 @@ SharedTreeNode<ChildType, ExtraState>::getWritableNode(uint32_t height) {
 
 }
 
-static bool derefLT(void** a, void** b) {
-  if(!a)
-    return !!b;
-  else if(!b)
-    return false;
-  else
-    return *a < *b;
-}
-
-static bool derefEQ(void** a, void** b) {
-
-  if(!a)
-    return !b;
-  else if(!b)
-    return false;
-  else
-    return (*a == *b);
-
-}
-
 template<class Base> struct IndirectComp {
 
-  static bool LT(void** a, void** b) {
+  static bool LT(void* a, void* b) {
 
     if(!a)
       return !!b;
     else if(!b)
       return false;
     else
-      return Base::LT((Base*)*a, (Base*)*b);
+      return Base::LT((Base*)a, (Base*)b);
 
   }
 
-  static bool EQ(void** a, void** b) {
+  static bool EQ(void* a, void* b) {
 
     if(!a)
       return !b;
     else if(!b)
       return false;
     else
-      return Base::EQ((Base*)*a, (Base*)*b);
+      return Base::EQ((Base*)a, (Base*)b);
 
   }
 
@@ -240,16 +289,19 @@ void SharedTreeNode<ChildType, ExtraState>
 
     for(uint32_t i = 0; i < HEAPTREEORDER; ++i) {
 
+      void* child = getChild(i);
+
       for(typename SmallVector<SharedTreeNode<ChildType, ExtraState>*, 4>::iterator it = others.begin(), itend = others.end();
-	  it != itend && children[i]; ++it) {
+	  it != itend && child; ++it) {
 
-	if((!*it) || !((*it)->children[i])) {
+	if((!*it) || !((*it)->getChild(i))) {
 
 	  if(height == 0)
-	    delete ((ChildType*)children[i]);
+	    delete ((ChildType*)child);
 	  else
-	    ((SharedTreeNode*)children[i])->dropReference(idx + i, height - 1, 0);
-	  children[i] = 0;
+	    ((SharedTreeNode*)child)->dropReference(idx + i, height - 1, 0);
+	  setChild(i, 0);
+	  child = 0;
 
 	}
 
@@ -265,14 +317,14 @@ void SharedTreeNode<ChildType, ExtraState>
     for(uint32_t i = 0; i < HEAPTREEORDER; ++i) {
 
       for(typename SmallVector<SharedTreeNode<ChildType, ExtraState>*, 4>::iterator it = others.begin(), 
-	    itend = others.end(); it != itend && !children[i]; ++it) {
+	    itend = others.end(); it != itend && !getChild(i); ++it) {
 
-	if((*it) && (*it)->children[i]) {
+	if((*it) && (*it)->getChild(i)) {
 
 	  if(height == 0)
-	    children[i] = new ChildType(ChildType::getEmptyStore().getReadableCopy());
+	    setChild(i, new ChildType(ChildType::getEmptyStore().getReadableCopy()));
 	  else
-	    children[i] = new SharedTreeNode();
+	    setChild(i, new SharedTreeNode());
 
 	}
 
@@ -286,41 +338,43 @@ void SharedTreeNode<ChildType, ExtraState>
 
   for(uint32_t i = 0; i < HEAPTREEORDER; ++i) {
 
-    if(!children[i])
+    void* child = getChild(i);
+    if(!child)
       continue;
 
     // Unique children regardless of whether they're further levels of TreeNode
     // or ChildTypes. In the former case this avoids merges of identical subtrees
     // in the latter it skips merging ChildTypes that are shared (as determined by ChildType::EQ)
     // In either case refcounting is caught up when unused maps are released at the top level.
-    SmallVector<void**, 4> incomingPtrs;
-    incomingPtrs.reserve(std::distance(others.begin(), others.end()) + 1);
+    SmallVector<void*, 4> incoming;
+    incoming.reserve(std::distance(others.begin(), others.end()) + 1);
 
-    incomingPtrs.push_back(&(children[i]));
+    incoming.push_back(child);
 
     for(typename SmallVector<SharedTreeNode<ChildType, ExtraState>*, 4>::iterator it = others.begin(), itend = others.end();
 	it != itend; ++it) {
 
-      if((!*it) || !(*it)->children[i])
-	incomingPtrs.push_back(0);
+      if(!*it)
+	incoming.push_back(0);
       else
-	incomingPtrs.push_back(&((*it)->children[i]));
+	incoming.push_back((*it)->getChild(i));
 
     }
 
     if(height == 0) {
 
-      std::sort(incomingPtrs.begin(), incomingPtrs.end(), IndirectComp<ChildType>::LT);
-      SmallVector<void**, 4>::iterator uniqend = std::unique(incomingPtrs.begin(), incomingPtrs.end(), IndirectComp<ChildType>::EQ);
+      std::sort(incoming.begin(), incoming.end(), IndirectComp<ChildType>::LT);
+      SmallVector<void*, 4>::iterator uniqend = std::unique(incoming.begin(), incoming.end(), IndirectComp<ChildType>::EQ);
       
       // This subtree never differs?
-      if(std::distance(incomingPtrs.begin(), uniqend) == 1)
+      if(std::distance(incoming.begin(), uniqend) == 1)
 	continue;
 
-      // Merge each child value.
-      for(SmallVector<void**, 4>::iterator it = incomingPtrs.begin(); it != uniqend; ++it) {
+      // Merge each child value. Leaf objects are never shared between nodes, so pointer
+      // equality identifies our own.
+      for(SmallVector<void*, 4>::iterator it = incoming.begin(); it != uniqend; ++it) {
 	
-	if(*it == &(children[i]))
+	if(*it == child)
 	  continue;
 
 	uint64_t ASize = getHeapAllocSize(ShadowValue::getPtrIdx(-1, idx + i));
@@ -329,41 +383,39 @@ void SharedTreeNode<ChildType, ExtraState>
 	if(!*it)
 	  mergeFromStore = &ChildType::getEmptyStore();
 	else
-	  mergeFromStore = (ChildType*)(**it);
+	  mergeFromStore = (ChildType*)(*it);
 
 	// mergeStores takes care of CoW break if necessary.
-	ChildType::mergeStores(mergeFromStore, (ChildType*)children[i], ASize, visitor);
-	((ChildType*)children[i])->checkMergedResult();
+	ChildType::mergeStores(mergeFromStore, (ChildType*)child, ASize, visitor);
+	((ChildType*)child)->checkMergedResult();
       
       }
 
     }
     else {
 
-      std::sort(incomingPtrs.begin(), incomingPtrs.end(), derefLT);
-      SmallVector<void**, 4>::iterator uniqend = std::unique(incomingPtrs.begin(), incomingPtrs.end(), derefEQ);
+      std::sort(incoming.begin(), incoming.end());
+      SmallVector<void*, 4>::iterator uniqend = std::unique(incoming.begin(), incoming.end());
       
       // This subtree never differs?
-      if(std::distance(incomingPtrs.begin(), uniqend) == 1)
+      if(std::distance(incoming.begin(), uniqend) == 1)
 	continue;
 
       // Recursively merge this child.
       // CoW break this subtree if necessary.
-      children[i] = ((SharedTreeNode*)children[i])->getWritableNode(height - 1);
+      SharedTreeNode* writableChild = ((SharedTreeNode*)child)->getWritableNode(height - 1);
+      setChild(i, writableChild);
 
       uint32_t newIdx = idx | (i << (HEAPTREEORDERLOG2 * height));
       SmallVector<SharedTreeNode*, 4> otherChildren;
-      for(SmallVector<void**, 4>::iterator it = incomingPtrs.begin(), itend = incomingPtrs.end();
-	  it != itend; ++it) {
+      for(SmallVector<void*, 4>::iterator it = incoming.begin(); it != uniqend; ++it) {
 	
-	if(!*it)
-	  otherChildren.push_back(0);
-	else
-	  otherChildren.push_back((SharedTreeNode*)**it);
+	if(*it != child)
+	  otherChildren.push_back((SharedTreeNode*)*it);
 
       }
 
-      ((SharedTreeNode*)children[i])->mergeHeaps(otherChildren, allOthersClobbered, height - 1, newIdx, visitor);
+      writableChild->mergeHeaps(otherChildren, allOthersClobbered, height - 1, newIdx, visitor);
 
     }
 
@@ -378,11 +430,12 @@ template<class ChildType, class ExtraState> void SharedTreeNode<ChildType, Extra
   if(height == 0) {
     
     for(uint32_t i = 0; i < HEAPTREEORDER; ++i) {
-      if(!children[i])
+      ChildType* child = (ChildType*)getChild(i);
+      if(!child)
 	continue;
       printSV(RSO, getAllocWithIdx(idx + i));
       RSO << ": ";
-      ((ChildType*)children[i])->print(RSO, brief);
+      child->print(RSO, brief);
       RSO << "\n";
     }
 
@@ -390,16 +443,94 @@ template<class ChildType, class ExtraState> void SharedTreeNode<ChildType, Extra
   else {
   
     for(uint32_t i = 0; i < HEAPTREEORDER; ++i) {
-      if(!children[i])
+      SharedTreeNode* child = (SharedTreeNode*)getChild(i);
+      if(!child)
 	continue;
       uint32_t newIdx = idx | (i << (HEAPTREEORDERLOG2 * height));
-      ((SharedTreeNode*)children[i])->print(RSO, brief, height - 1, newIdx);
+      child->print(RSO, brief, height - 1, newIdx);
     }
      
   } 
 
 }
 
+// Does the subtree at idx / height hold an entry for any heap slot marked in dead?
+template<class ChildType, class ExtraState> 
+bool SharedTreeNode<ChildType, ExtraState>::hasDeadSlots(uint32_t idx, uint32_t height, const BitVector& dead) {
+
+  uint64_t span = ((uint64_t)1) << ((height + 1) * HEAPTREEORDERLOG2);
+  int next = idx == 0 ? dead.find_first() : dead.find_next(idx - 1);
+  if(next == -1 || (uint64_t)next >= idx + span)
+    return false;
+
+  for(uint32_t i = 0; i < HEAPTREEORDER; ++i) {
+
+    void* child = getChild(i);
+    if(!child)
+      continue;
+
+    if(height == 0) {
+      uint32_t childIdx = idx + i;
+      if(childIdx < dead.size() && dead[childIdx])
+	return true;
+    }
+    else if(((SharedTreeNode*)child)->hasDeadSlots(idx + (i << (height * HEAPTREEORDERLOG2)), height - 1, dead)) {
+      return true;
+    }
+
+  }
+
+  return false;
+
+}
+
+// Remove entries for the heap slots marked in dead (see HeapReclaim.cpp), along with any nodes left empty.
+// Nodes shared with other trees are COW broken first, and only if they really hold a dead slot.
+// Returns the node that should replace this one in its parent.
+template<class ChildType, class ExtraState> 
+SharedTreeNode<ChildType, ExtraState>* SharedTreeNode<ChildType, ExtraState>::dropDeadSlots(uint32_t idx, uint32_t height, const BitVector& dead) {
+
+  if(!hasDeadSlots(idx, height, dead))
+    return this;
+
+  SharedTreeNode* node = getWritableNode(height);
+
+  for(uint32_t i = 0; i < HEAPTREEORDER; ++i) {
+
+    void* child = node->getChild(i);
+    if(!child)
+      continue;
+
+    if(height == 0) {
+
+      uint32_t childIdx = idx + i;
+      if(childIdx < dead.size() && dead[childIdx]) {
+	((ChildType*)child)->dropReference();
+	delete ((ChildType*)child);
+	node->setChild(i, 0);
+      }
+
+    }
+    else {
+
+      SharedTreeNode* childNode = (SharedTreeNode*)child;
+      SharedTreeNode* newChild = childNode->dropDeadSlots(idx + (i << (height * HEAPTREEORDERLOG2)), height - 1, dead);
+      if(!newChild->countChildren()) {
+	newChild->dropReference(0, height - 1, 0);
+	node->setChild(i, 0);
+      }
+      else if(newChild != childNode) {
+	node->setChild(i, newChild);
+      }
+
+    }
+
+  }
+
+  return node;
+
+}
+
 template<class ChildType, class ExtraState> struct SharedTreeRoot {
 
   SharedTreeNode<ChildType, ExtraState>* root;
@@ -413,6 +544,10 @@ SharedTreeRoot() : root(0), height(0) { }
   void growToHeight(uint32_t newHeight);
   void grow(uint32_t idx);
   bool mustGrowFor(uint32_t idx);
+  void dropDeadSlots(const BitVector& dead) {
+    if(height != 0)
+      root = root->dropDeadSlots(0, height - 1, dead);
+  }
 
 };
 
@@ -455,7 +590,7 @@ template<class ChildType, class ExtraState> void SharedTreeRoot<ChildType, Extra
   for(uint32_t i = 0, ilim = (newHeight - height); i != ilim; ++i) {
 
     SharedTreeNode<ChildType, ExtraState>* newNode = new SharedTreeNode<ChildType, ExtraState>();
-    newNode->children[0] = root;
+    newNode->setChild(0, root);
     root = newNode;
 
   }
@@ -528,15 +663,91 @@ template<class ChildType, class ExtraState> bool SharedTreeRoot<ChildType, Extra
 
 }
 
+#define FRAMECHUNKSIZE 16
+#define FRAMECHUNKSIZELOG2 4
+
+// A fixed-size run of stack frame slots. Chunks are shared between frame maps and copied on write,
+// so writing one slot of a shared frame only copies the chunk that contains it.
+template<class ChildType> struct FrameChunk {
+
+  ChildType slots[FRAMECHUNKSIZE];
+  uint32_t refCount;
+
+  static uint64_t cowBreaks;
+
+FrameChunk() : refCount(1) { }
+
+  FrameChunk* getWritableChunk();
+  void dropReference(uint32_t stack_depth, uint32_t base, std::vector<ShadowValue>* simplified);
+
+};
+
+template<class ChildType> uint64_t FrameChunk<ChildType>::cowBreaks = 0;
+
+template<class ChildType> FrameChunk<ChildType>* FrameChunk<ChildType>::getWritableChunk() {
+
+  if(refCount == 1)
+    return this;
+
+  ++cowBreaks;
+  FrameChunk* newChunk = new FrameChunk();
+  for(uint32_t i = 0; i != FRAMECHUNKSIZE; ++i) {
+    if(slots[i].isValid())
+      newChunk->slots[i] = slots[i].getReadableCopy();
+  }
+
+  // Can't destroy: refCount > 1
+  --refCount;
+
+  return newChunk;
+
+}
+
+template<class ChildType> void FrameChunk<ChildType>::dropReference(uint32_t stack_depth, uint32_t base, std::vector<ShadowValue>* simplified) {
+
+  if(--refCount)
+    return;
+
+  for(uint32_t i = 0; i != FRAMECHUNKSIZE; ++i) {
+    if(!slots[i].isValid())
+      continue;
+    if(simplified && slots[i].derefWillAllowSimplify())
+      simplified->push_back(ShadowValue::getPtrIdx(stack_depth, base + i));
+    slots[i].dropReference();
+  }
+
+  delete this;
+
+}
+
 template<class ChildType, class ExtraState> struct SharedStoreMap {
 
-  std::vector<ChildType> store;
+  // Slot i lives in chunks[i / FRAMECHUNKSIZE]; a null chunk has no valid slots.
+  std::vector<FrameChunk<ChildType>*> chunks;
+  uint32_t nSlots;
   uint32_t refCount;
   InlineAttempt* IA;
   bool empty;
 
-SharedStoreMap(InlineAttempt* _IA, uint32_t initSize) : store(initSize), refCount(1), IA(_IA), empty(true) { }
+  static uint64_t cowBreaks;
+
+SharedStoreMap(InlineAttempt* _IA, uint32_t initSize) : chunks((initSize + FRAMECHUNKSIZE - 1) >> FRAMECHUNKSIZELOG2), nSlots(initSize), refCount(1), IA(_IA), empty(true) { }
+
+  uint32_t size() const {
+    return nSlots;
+  }
+
+  // Returns 0 for an invalid slot.
+  ChildType* getReadableSlot(uint32_t i) const {
+    FrameChunk<ChildType>* chunk = chunks[i >> FRAMECHUNKSIZELOG2];
+    if(!chunk)
+      return 0;
+    ChildType* ret = &(chunk->slots[i & (FRAMECHUNKSIZE - 1)]);
+    return ret->isValid() ? ret : 0;
+  }
 
+  ChildType& getWritableSlot(uint32_t i);
+  void resize(uint32_t newSize, uint32_t stack_depth);
   SharedStoreMap* getWritableStoreMap();
   bool dropReference(uint32_t stack_depth, std::vector<ShadowValue>* simplified);
   void clear(uint32_t stack_depth, std::vector<ShadowValue>* simplified);
@@ -545,6 +756,46 @@ SharedStoreMap(InlineAttempt* _IA, uint32_t initSize) : store(initSize), refCoun
 
 };
 
+template<class ChildType, class ExtraState> uint64_t SharedStoreMap<ChildType, ExtraState>::cowBreaks = 0;
+
+// This map must already be writable. CoW breaks the chunk containing slot i if necessary.
+template<class ChildType, class ExtraState> ChildType& SharedStoreMap<ChildType, ExtraState>::getWritableSlot(uint32_t i) {
+
+  FrameChunk<ChildType>*& chunk = chunks[i >> FRAMECHUNKSIZELOG2];
+  if(!chunk)
+    chunk = new FrameChunk<ChildType>();
+  else
+    chunk = chunk->getWritableChunk();
+
+  return chunk->slots[i & (FRAMECHUNKSIZE - 1)];
+
+}
+
+// This map must already be writable. Slots dropped by shrinking release their references.
+template<class ChildType, class ExtraState> void SharedStoreMap<ChildType, ExtraState>::resize(uint32_t newSize, uint32_t stack_depth) {
+
+  uint32_t newChunks = (newSize + FRAMECHUNKSIZE - 1) >> FRAMECHUNKSIZELOG2;
+
+  for(uint32_t i = newSize, ilim = std::min(nSlots, newChunks << FRAMECHUNKSIZELOG2); i < ilim; ++i) {
+
+    if(getReadableSlot(i)) {
+      ChildType& slot = getWritableSlot(i);
+      slot.dropReference();
+      slot = ChildType();
+    }
+
+  }
+
+  for(uint32_t i = newChunks, ilim = chunks.size(); i < ilim; ++i) {
+    if(chunks[i])
+      chunks[i]->dropReference(stack_depth, i << FRAMECHUNKSIZELOG2, 0);
+  }
+
+  chunks.resize(newChunks);
+  nSlots = newSize;
+
+}
+
 template<class ChildType, class ExtraState> SharedStoreMap<ChildType, ExtraState>* SharedStoreMap<ChildType, ExtraState>::getWritableStoreMap() {
 
   // Refcount == 1 means we can just write in place.
@@ -553,18 +804,20 @@ template<class ChildType, class ExtraState> SharedStoreMap<ChildType, ExtraState
     return this;
   }
 
-  // COW break: copy the map and either share or copy its entries.
-  LFV3(errs() << "COW break local map " << this << " with " << store.size() << " entries\n");
-  SharedStoreMap* newMap = new SharedStoreMap(IA, store.size());
+  // COW break: share all of our chunks with the copy; they are themselves copied on write.
+  LFV3(errs() << "COW break local map " << this << " with " << nSlots << " entries\n");
+  ++cowBreaks;
+  SharedStoreMap* newMap = new SharedStoreMap(IA, nSlots);
 
-  uint32_t i = 0;
-  for(typename std::vector<ChildType>::iterator it = store.begin(), it2 = store.end(); it != it2; ++it, ++i) {
-    if(!it->isValid())
-      continue;
-    newMap->store[i] = it->getReadableCopy();
-    newMap->empty = false;
+  for(uint32_t i = 0, ilim = chunks.size(); i != ilim; ++i) {
+    if(chunks[i]) {
+      ++chunks[i]->refCount;
+      newMap->chunks[i] = chunks[i];
+    }
   }
 
+  newMap->empty = empty;
+
   // Drop reference on the existing map (can't destroy it):
   refCount--;
   
@@ -597,25 +850,22 @@ template<class ChildType, class ExtraState> void SharedStoreMap<ChildType, Extra
 
   release_assert(refCount <= 1 && "clear() against shared map?");
 
-  // Drop references to any maps this points to;
-  uint32_t i = 0;
-  for(typename std::vector<ChildType>::iterator it = store.begin(), itend = store.end(); it != itend; ++it, ++i) {
-    if(!it->isValid())
-      continue;
-    if(simplified && it->derefWillAllowSimplify())
-      simplified->push_back(ShadowValue::getPtrIdx(stack_depth, i));
-    it->dropReference();
+  // Drop references to our chunks, and so to any maps they point to if we were the last user.
+  for(uint32_t i = 0, ilim = chunks.size(); i != ilim; ++i) {
+    if(chunks[i])
+      chunks[i]->dropReference(stack_depth, i << FRAMECHUNKSIZELOG2, simplified);
   }
 
-  store.clear();
-  store.resize(allocFrameSize(IA));
+  nSlots = allocFrameSize(IA);
+  chunks.clear();
+  chunks.resize((nSlots + FRAMECHUNKSIZE - 1) >> FRAMECHUNKSIZELOG2);
   empty = true;
 
 }
 
 template<class ChildType, class ExtraState> SharedStoreMap<ChildType, ExtraState>* SharedStoreMap<ChildType, ExtraState>::getEmptyMap(uint32_t stack_depth) {
 
-  if(!store.size())
+  if(!nSlots)
     return this;
   else if(refCount == 1) {
     clear(stack_depth, 0);
@@ -623,7 +873,7 @@ template<class ChildType, class ExtraState> SharedStoreMap<ChildType, ExtraState
   }
   else {
     dropReference(stack_depth, 0);
-    return new SharedStoreMap<ChildType, ExtraState>(IA, store.size());
+    return new SharedStoreMap<ChildType, ExtraState>(IA, nSlots);
   }
 
 }
@@ -656,12 +906,14 @@ ShadowValue getStackAllocationWithIndex(InlineAttempt*, uint32_t);
 
 template<class ChildType, class ExtraState> void SharedStoreMap<ChildType, ExtraState>::print(raw_ostream& RSO, bool brief) {
 
-  uint32_t i = 0;
-  for(typename std::vector<ChildType>::iterator it = store.begin(), itend = store.end(); it != itend; ++it, ++i) {
+  for(uint32_t i = 0; i != nSlots; ++i) {
 
+    ChildType* slot = getReadableSlot(i);
+    if(!slot)
+      continue;
     printSV(RSO, getStackAllocationWithIndex(IA, i));
     RSO << ": ";
-    it->print(RSO, brief);
+    slot->print(RSO, brief);
     RSO << "\n";
 
   }
@@ -680,9 +932,35 @@ template<class ChildType, class ExtraState> struct LocalStoreMap {
   bool allOthersClobbered;
   uint32_t refCount;
 
+  // Renewed whenever the map may be modified in place, so a map seen again at the same
+  // address and version has the same contents.
+  uint64_t version;
+  static uint64_t nextVersion;
+
   ExtraState es;
 
-LocalStoreMap(uint32_t s) : frames(s), heap(), allOthersClobbered(false), refCount(1) {}
+  // Every live map of this kind, so that heap slot reclamation can find all references to a slot
+  // no matter which block, context or cache is holding the map.
+  static LocalStoreMap* liveMaps;
+  LocalStoreMap* prevLive;
+  LocalStoreMap* nextLive;
+
+  static uint64_t cowBreaks;
+
+LocalStoreMap(uint32_t s) : frames(s), heap(), allOthersClobbered(false), refCount(1), version(++nextVersion), prevLive(0), nextLive(liveMaps) {
+    if(liveMaps)
+      liveMaps->prevLive = this;
+    liveMaps = this;
+  }
+
+  ~LocalStoreMap() {
+    if(prevLive)
+      prevLive->nextLive = nextLive;
+    else
+      liveMaps = nextLive;
+    if(nextLive)
+      nextLive->prevLive = prevLive;
+  }
 
   void clear();
   LocalStoreMap* getEmptyMap();
@@ -692,28 +970,37 @@ LocalStoreMap(uint32_t s) : frames(s), heap(), allOthersClobbered(false), refCou
   bool empty();
   void copyEmptyFrames(SmallVector<SharedStoreMap<ChildType, ExtraState>*, 4>&);
   void copyFramesFrom(const LocalStoreMap<ChildType, ExtraState>&);
-  std::vector<ChildType>& getWritableFrame(int32_t frameNo);
+  FrameType* getWritableFrame(int32_t frameNo);
   void pushStackFrame(InlineAttempt*);
   void popStackFrame();
   ChildType* getReadableStoreFor(const ShadowValue& V);
   ChildType* getOrCreateStoreFor(ShadowValue& V, bool* isNewStore);
+  void dropDeadSlots(const BitVector& dead) {
+    heap.dropDeadSlots(dead);
+    es.dropDeadObjects(dead);
+  }
 
 };
 
+template<class ChildType, class ExtraState> LocalStoreMap<ChildType, ExtraState>* LocalStoreMap<ChildType, ExtraState>::liveMaps = 0;
+template<class ChildType, class ExtraState> uint64_t LocalStoreMap<ChildType, ExtraState>::cowBreaks = 0;
+template<class ChildType, class ExtraState> uint64_t LocalStoreMap<ChildType, ExtraState>::nextVersion = 0;
+
 template<class ChildType, class ExtraState>
 ChildType* LocalStoreMap<ChildType, ExtraState>::getOrCreateStoreFor(ShadowValue& V, bool* isNewStore) {
 
   int32_t frameNo = V.getFrameNo();
   if(frameNo != -1) {
 
-    std::vector<ChildType>& frameMap = getWritableFrame(frameNo);
-    frames[frameNo]->empty = false;
+    FrameType* frame = getWritableFrame(frameNo);
+    frame->empty = false;
     int32_t framePos = V.getFramePos();
     release_assert(framePos >= 0 && "Stack entry without an index?");
-    if(frameMap.size() <= (uint32_t)framePos)
-      frameMap.resize(framePos + 1);
-    *isNewStore = !(frameMap[framePos].isValid());
-    return &(frameMap[framePos]);
+    if(frame->size() <= (uint32_t)framePos)
+      frame->resize(framePos + 1, frameNo);
+    ChildType& slot = frame->getWritableSlot(framePos);
+    *isNewStore = !(slot.isValid());
+    return &slot;
 
   }
   else {
@@ -731,16 +1018,12 @@ template<class ChildType, class ExtraState> ChildType* LocalStoreMap<ChildType,
     return heap.getReadableStoreFor(V);
   else {
 
-    std::vector<ChildType>& frame = frames[frameNo]->store;
+    FrameType* frame = frames[frameNo];
     uint32_t frameIdx = V.getFramePos();
-    if(frame.size() <= frameIdx)
+    if(frame->size() <= frameIdx)
       return 0;
 
-    ChildType* ret = &(frame[frameIdx]);
-    if(!ret->isValid())
-      return 0;
-    else
-      return ret;
+    return frame->getReadableSlot(frameIdx);
 
   }
   
@@ -748,9 +1031,12 @@ template<class ChildType, class ExtraState> ChildType* LocalStoreMap<ChildType,
 
 template<class ChildType, class ExtraState> LocalStoreMap<ChildType, ExtraState>* LocalStoreMap<ChildType, ExtraState>::getWritableFrameList() {
 
-  if(refCount == 1)
+  if(refCount == 1) {
+    version = ++nextVersion;
     return this;
+  }
 
+  ++cowBreaks;
   LocalStoreMap<ChildType, ExtraState>* newMap = new LocalStoreMap<ChildType, ExtraState>(frames.size());
   newMap->copyFramesFrom(*this);
 
@@ -763,11 +1049,11 @@ template<class ChildType, class ExtraState> LocalStoreMap<ChildType, ExtraState>
 
 }
 
-template<class ChildType, class ExtraState> std::vector<ChildType>& LocalStoreMap<ChildType, ExtraState>::getWritableFrame(int32_t frameNo) {
+template<class ChildType, class ExtraState> typename LocalStoreMap<ChildType, ExtraState>::FrameType* LocalStoreMap<ChildType, ExtraState>::getWritableFrame(int32_t frameNo) {
 
   release_assert(frameNo >= 0 && frameNo < (int32_t)frames.size());
   frames[frameNo] = frames[frameNo]->getWritableStoreMap();
-  return frames[frameNo]->store;
+  return frames[frameNo];
 
 }
 
@@ -795,10 +1081,13 @@ template<class ChildType, class ExtraState> bool LocalStoreMap<ChildType, ExtraS
 
 template<class ChildType, class ExtraState> LocalStoreMap<ChildType, ExtraState>* LocalStoreMap<ChildType, ExtraState>::getEmptyMap() {
 
-  if(empty())
+  if(empty()) {
+    version = ++nextVersion;
     return this;
+  }
   else if(refCount == 1) {
     clear();
+    version = ++nextVersion;
     return this;
   }
   else {
@@ -920,6 +1209,10 @@ template<class ChildType, class ExtraState> struct MergeBlockVisitor : public Sh
   void visit(ShadowBB* BB, void* Ctx, bool mustCopyCtx) {
     incomingBlocks.push_back(BB);
   }
+  // Use incoming blocks already found by another merger's predecessor walk.
+  void setIncomingBlocks(ArrayRef<ShadowBB*> BBs) {
+    incomingBlocks.append(BBs.begin(), BBs.end());
+  }
   void doMerge();
 
 };
@@ -1027,7 +1320,7 @@ void MergeBlockVisitor<ChildType, ExtraState>::
 
     for(uint32_t i = 0; i < tempFramesToRemove; ++i) {
       NodeType* removeNode = thisMap->heap.root;
-      thisMap->heap.root = (NodeType*)thisMap->heap.root->children[0];
+      thisMap->heap.root = (NodeType*)thisMap->heap.root->getChild(0);
       release_assert(removeNode->refCount == 1 && "Removing shared node in post-treemerge cleanup?");
       delete removeNode;
     }
@@ -1055,9 +1348,8 @@ void MergeBlockVisitor<ChildType, ExtraState>::mergeFrames(MapType* toMap, typen
   if(std::distance(incomingFrames.begin(), uniqend) == 1)
     return;
 
-  // CoW break stack frame if necessary
+  // CoW break stack frame if necessary. Its chunks are broken individually as slots are written.
   FrameType* mergeToFrame = toMap->frames[idx] = toMap->frames[idx]->getWritableStoreMap();
-  std::vector<ChildType>& mergeToStore = mergeToFrame->store;
 
   InlineAttempt* thisFrameIA = mergeToFrame->IA;
 
@@ -1067,7 +1359,6 @@ void MergeBlockVisitor<ChildType, ExtraState>::mergeFrames(MapType* toMap, typen
     FrameType* mergeFromFrame = *it;
     if(mergeFromFrame == mergeToFrame)
       continue;
-    std::vector<ChildType>& mergeFromStore = mergeFromFrame->store;
 
     if(toMap->allOthersClobbered) {
       
@@ -1076,17 +1367,18 @@ void MergeBlockVisitor<ChildType, ExtraState>::mergeFrames(MapType* toMap, typen
 
       // Remove any existing mappings in mergeToFrame that do not occur in mergeFromFrame:
 
-      for(uint32_t i = 0, ilim = mergeToStore.size(); i != ilim; ++i) {
+      for(uint32_t i = 0, ilim = mergeToFrame->size(); i != ilim; ++i) {
 
-	if(mergeToStore[i].isValid() && (i >= mergeFromStore.size() || !mergeFromStore[i].isValid())) {
-	  mergeToStore[i].dropReference();
-	  mergeToStore[i] = ChildType();
+	if(mergeToFrame->getReadableSlot(i) && (i >= mergeFromFrame->size() || !mergeFromFrame->getReadableSlot(i))) {
+	  ChildType& mergeToSlot = mergeToFrame->getWritableSlot(i);
+	  mergeToSlot.dropReference();
+	  mergeToSlot = ChildType();
 	}
 
       }
 
-      if(mergeToStore.size() > mergeFromStore.size())
-	mergeToStore.resize(mergeFromStore.size());
+      if(mergeToFrame->size() > mergeFromFrame->size())
+	mergeToFrame->resize(mergeFromFrame->size(), idx);
 
     }
     else {
@@ -1098,13 +1390,13 @@ void MergeBlockVisitor<ChildType, ExtraState>::mergeFrames(MapType* toMap, typen
       // This will get overwritten below but creates the asymmetry that 
       // x in mergeFromFrame -> x in mergeToFrame.
 
-      if(mergeFromStore.size() > mergeToStore.size())
-	mergeToStore.resize(mergeFromStore.size());
+      if(mergeFromFrame->size() > mergeToFrame->size())
+	mergeToFrame->resize(mergeFromFrame->size(), idx);
 
-      for(uint32_t i = 0, ilim = mergeFromStore.size(); i != ilim; ++i) {
+      for(uint32_t i = 0, ilim = mergeFromFrame->size(); i != ilim; ++i) {
 	  
-	if(mergeFromStore[i].isValid() && !mergeToStore[i].isValid()) {
-	  mergeToStore[i] = ChildType::getEmptyStore().getReadableCopy();
+	if(mergeFromFrame->getReadableSlot(i) && !mergeToFrame->getReadableSlot(i)) {
+	  mergeToFrame->getWritableSlot(i) = ChildType::getEmptyStore().getReadableCopy();
 	  mergeToFrame->empty = false;
 	}
 	
@@ -1118,15 +1410,15 @@ void MergeBlockVisitor<ChildType, ExtraState>::mergeFrames(MapType* toMap, typen
   // Note that in the allOthersClobbered case this only merges in
   // information from locations explicitly mentioned in all incoming frames.
 
-  for(uint32_t i = 0, ilim = mergeToStore.size(); i != ilim; ++i) {
+  for(uint32_t i = 0, ilim = mergeToFrame->size(); i != ilim; ++i) {
 
-    if(!mergeToStore[i].isValid())
+    ChildType* mergeToLoc = mergeToFrame->getReadableSlot(i);
+    if(!mergeToLoc)
       continue;
 
-    ChildType* mergeToLoc = &(mergeToStore[i]);
-
     uint64_t mergeSize = getAllocSize(thisFrameIA, i);
 
+    // Incoming stores identical to our own have nothing to contribute.
     SmallVector<ChildType*, 4> incomingStores;
 
     for(typename SmallVector<SharedStoreMap<ChildType, ExtraState>*, 4>::iterator incit = incomingFrames.begin(); incit != uniqend; ++incit) {
@@ -1135,17 +1427,25 @@ void MergeBlockVisitor<ChildType, ExtraState>::mergeFrames(MapType* toMap, typen
       if(mergeFromFrame == mergeToFrame)
 	continue;
 
-      ChildType* mergeFromLoc;
+      ChildType* mergeFromLoc = 0;
 
-      if(mergeFromFrame->store.size() > i && mergeFromFrame->store[i].isValid())
-	mergeFromLoc = &(mergeFromFrame->store[i]);
-      else
+      if(mergeFromFrame->size() > i)
+	mergeFromLoc = mergeFromFrame->getReadableSlot(i);
+      if(!mergeFromLoc)
 	mergeFromLoc = &(ChildType::getEmptyStore());
 
-      incomingStores.push_back(mergeFromLoc);
+      if(!ChildType::EQ(mergeFromLoc, mergeToLoc))
+	incomingStores.push_back(mergeFromLoc);
 
     }
 
+    // Only copy the slot's chunk if something will actually be merged into it; an untouched slot
+    // may still be shared with other maps, so it mustn't be simplified in place either.
+    if(incomingStores.empty())
+      continue;
+
+    mergeToLoc = &(mergeToFrame->getWritableSlot(i));
+
     std::sort(incomingStores.begin(), incomingStores.end(), ChildType::LT);
     typename SmallVector<ChildType*, 4>::iterator storeuniqend = 
       std::unique(incomingStores.begin(), incomingStores.end(), ChildType::EQ);
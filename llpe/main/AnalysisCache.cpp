@@ -0,0 +1,310 @@
+//===-- AnalysisCache.cpp -------------------------------------------------===//
+//
+//                                  LLPE
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.txt for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Analysis/LLPE.h"
+
+#include "llvm/ADT/StringSet.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+
+#include <openssl/sha.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define DEBUG_TYPE "llpe-misc"
+
+using namespace llvm;
+
+// An on-disk cache of whole specialisation results. An entry is keyed by the SHA-1 of the input
+// module's bitcode and the command line less the output path, and records the SHA-1 of every file
+// specialisation consulted: files stat'd or read through the VFS, including probes of files that
+// turned out not to exist, plus argv / env / path condition inputs. If all of those are still in
+// the same state, commit() links the cached specialised module over the input instead of
+// re-running the analysis.
+//
+// Entries live in DIR/<key>.bc and DIR/<key>.deps. Each line of the latter reads
+// "<kind> <sha1-or-'-'> <path>", where kind is 'v' for a file that lliowd must watch at runtime
+// and 'i' for a specialisation-time input, and '-' marks a file that did not exist.
+
+static cl::opt<std::string> AnalysisCacheDir("llpe-cache-dir", cl::init(""));
+
+static void writeHex(raw_ostream& Out, const unsigned char* hash) {
+
+  for(int i = 0; i < SHA_DIGEST_LENGTH; ++i) {
+
+    if(hash[i]/16 == 0)
+      Out << '0';
+    Out.write_hex(hash[i]);
+
+  }
+
+}
+
+// Describe file Filename's content as of this run's snapshot: its SHA-1, "-" if it doesn't exist, or "?" if it couldn't be read.
+static std::string describeFile(const std::string& Filename) {
+
+  struct stat st;
+  if(statCachedFile(Filename, &st) == -1 && errno == ENOENT)
+    return "-";
+
+  unsigned char hash[SHA_DIGEST_LENGTH];
+  if(!getFileSha1(Filename, hash))
+    return "?";
+
+  std::string ret;
+  raw_string_ostream RSO(ret);
+  writeHex(RSO, hash);
+  RSO.flush();
+  return ret;
+
+}
+
+// Compute this run's cache key from the input module and our own command line.
+static bool getCacheKey(Module& M, std::string& Key) {
+
+  // procfs reports a zero size, so read it by hand rather than through MemoryBuffer.
+  std::string CmdLine;
+  int cmdfd = open("/proc/self/cmdline", O_RDONLY);
+  if(cmdfd == -1) {
+    errs() << "Can't read command line, analysis cache disabled\n";
+    return false;
+  }
+
+  char readbuf[4096];
+  int thisread;
+  while((thisread = read(cmdfd, readbuf, 4096)) > 0)
+    CmdLine.append(readbuf, thisread);
+  close(cmdfd);
+
+  if(thisread == -1) {
+    errs() << "Can't read command line, analysis cache disabled\n";
+    return false;
+  }
+
+  // Where the result is written doesn't change what it is, so leave -o out of the key.
+  std::string KeyCmdLine;
+  SmallVector<StringRef, 16> Args;
+  StringRef(CmdLine).split(Args, '\0', -1, false);
+  for(uint32_t i = 0, ilim = Args.size(); i != ilim; ++i) {
+
+    StringRef Arg = Args[i];
+    if(Arg == "-o" || Arg == "--o") {
+      ++i;
+      continue;
+    }
+    if(Arg.startswith("-o=") || Arg.startswith("--o="))
+      continue;
+
+    KeyCmdLine += Arg;
+    KeyCmdLine += '\0';
+
+  }
+
+  SmallVector<char, 65536> Bitcode;
+  {
+    raw_svector_ostream BCOut(Bitcode);
+    WriteBitcodeToFile(M, BCOut);
+  }
+
+  SHA_CTX hashctx;
+  unsigned char hash[SHA_DIGEST_LENGTH];
+  if((!SHA1_Init(&hashctx)) ||
+     (!SHA1_Update(&hashctx, Bitcode.data(), Bitcode.size())) ||
+     (!SHA1_Update(&hashctx, KeyCmdLine.data(), KeyCmdLine.size())) ||
+     (!SHA1_Final(hash, &hashctx))) {
+    errs() << "SHA-1 failed, analysis cache disabled\n";
+    return false;
+  }
+
+  raw_string_ostream RSO(Key);
+  writeHex(RSO, hash);
+  RSO.flush();
+  return true;
+
+}
+
+static std::string getCachePath(const std::string& Key, const char* Ext) {
+
+  return AnalysisCacheDir + "/" + Key + Ext;
+
+}
+
+// Check every file recorded in the dependency list at DepsPath is in the same state as when the
+// entry was made, and collect those that lliowd must watch.
+static bool depsStillMatch(const std::string& DepsPath, std::vector<std::string>& watchedFiles) {
+
+  ErrorOr<std::unique_ptr<MemoryBuffer> > Deps = MemoryBuffer::getFile(DepsPath);
+  if(!Deps)
+    return false;
+
+  SmallVector<StringRef, 16> Lines;
+  (*Deps)->getBuffer().split(Lines, '\n', -1, false);
+  for(uint32_t i = 0, ilim = Lines.size(); i != ilim; ++i) {
+
+    StringRef Kind, Rest, Hash, Path;
+    std::tie(Kind, Rest) = Lines[i].split(' ');
+    std::tie(Hash, Path) = Rest.split(' ');
+
+    if(Path.empty() || (Kind != "v" && Kind != "i"))
+      return false;
+
+    if(describeFile(Path.str()) != Hash) {
+      errs() << "Analysis cache: " << Path << " has changed\n";
+      return false;
+    }
+
+    if(Kind == "v")
+      watchedFiles.push_back(Path.str());
+
+  }
+
+  return true;
+
+}
+
+static std::unique_ptr<Module> loadCachedModule(const std::string& BCPath, LLVMContext& Context) {
+
+  SMDiagnostic Err;
+  std::unique_ptr<Module> Cached = parseIRFile(BCPath, Err, Context);
+  if(!Cached)
+    errs() << "Analysis cache: failed to load " << BCPath << ": " << Err.getMessage() << "\n";
+
+  return Cached;
+
+}
+
+// Called at the start of runOnModule, before anything modifies M. Returns true if a valid
+// cached result was found, in which case the caller should skip analysis entirely.
+bool LLPEAnalysisPass::lookupAnalysisCache(Module& M) {
+
+  analysisCacheKey.clear();
+  cachedModule = 0;
+
+  // The GUI driver needs the analysed context tree, which the cache doesn't record.
+  if(AnalysisCacheDir.empty() || IHPSaveDOTFiles)
+    return false;
+
+  if(!getCacheKey(M, analysisCacheKey)) {
+    analysisCacheKey.clear();
+    return false;
+  }
+
+  std::vector<std::string> watchedFiles;
+  std::unique_ptr<Module> Cached;
+
+  if(!(depsStillMatch(getCachePath(analysisCacheKey, ".deps"), watchedFiles) &&
+       (Cached = loadCachedModule(getCachePath(analysisCacheKey, ".bc"), M.getContext())))) {
+
+    // Checking the entry took snapshots of files this run may never consult; start afresh so
+    // that the entry we store later lists only what specialisation really looked at.
+    clearFileSnapshots();
+    return false;
+
+  }
+
+  errs() << "Using cached specialisation " << analysisCacheKey << "\n";
+  llioDependentFiles = watchedFiles;
+  cachedModule = Cached.release();
+  cacheTargetModule = &M;
+  return true;
+
+}
+
+// Called by commit() instead of the usual commit logic on a cache hit: replace the input module's
+// definitions with those from the cached specialised module.
+void LLPEAnalysisPass::applyAnalysisCache() {
+
+  std::unique_ptr<Module> Cached(cachedModule);
+  cachedModule = 0;
+
+  if(Linker::linkModules(*cacheTargetModule, std::move(Cached), Linker::Flags::OverrideFromSrc)) {
+    errs() << "Analysis cache: failed to link cached specialisation\n";
+    exit(1);
+  }
+
+  if(!(omitChecks || llioDependentFiles.empty()))
+    writeLliowdConfig();
+
+}
+
+// Called at the end of commit(): record the specialised module and everything it depended upon.
+void LLPEAnalysisPass::storeAnalysisCache(Module& M) {
+
+  if(analysisCacheKey.empty())
+    return;
+
+  if(std::error_code EC = sys::fs::create_directories(AnalysisCacheDir)) {
+    errs() << "Analysis cache: failed to create " << AnalysisCacheDir << ": " << EC.message() << "\n";
+    return;
+  }
+
+  std::string BCPath = getCachePath(analysisCacheKey, ".bc");
+  std::string DepsPath = getCachePath(analysisCacheKey, ".deps");
+
+  // Take the list of consulted files before describeFile adds anything of its own.
+  std::vector<std::string> consultedFiles;
+  getSnapshotFiles(consultedFiles);
+
+  std::string DepsText;
+  {
+    StringSet<> listed;
+    raw_string_ostream RSO(DepsText);
+    for(uint32_t i = 0, ilim = llioDependentFiles.size(); i != ilim; ++i) {
+      if(listed.insert(llioDependentFiles[i]).second)
+	RSO << "v " << describeFile(llioDependentFiles[i]) << " " << llioDependentFiles[i] << "\n";
+    }
+    for(uint32_t i = 0, ilim = specInputFiles.size(); i != ilim; ++i) {
+      if(listed.insert(specInputFiles[i]).second)
+	RSO << "i " << describeFile(specInputFiles[i]) << " " << specInputFiles[i] << "\n";
+    }
+    // Everything else stat'd or read, including files that didn't exist: creating one of those
+    // would change the result too.
+    for(uint32_t i = 0, ilim = consultedFiles.size(); i != ilim; ++i) {
+      if(listed.insert(consultedFiles[i]).second)
+	RSO << "i " << describeFile(consultedFiles[i]) << " " << consultedFiles[i] << "\n";
+    }
+  }
+
+  if(DepsText.find(" ? ") != std::string::npos) {
+    errs() << "Analysis cache: couldn't hash all dependencies, not caching this result\n";
+    return;
+  }
+
+  // Invalidate any existing entry before replacing its module.
+  sys::fs::remove(DepsPath);
+
+  {
+    std::error_code EC;
+    raw_fd_ostream BCOut(BCPath, EC, sys::fs::F_None);
+    if(EC) {
+      errs() << "Analysis cache: failed to open " << BCPath << ": " << EC.message() << "\n";
+      return;
+    }
+    WriteBitcodeToFile(M, BCOut);
+  }
+
+  // Write the dependency list last, so an entry is only ever valid once its module is complete.
+  std::error_code EC;
+  raw_fd_ostream DepsOut(DepsPath, EC, sys::fs::F_None);
+  if(EC) {
+    errs() << "Analysis cache: failed to open " << DepsPath << ": " << EC.message() << "\n";
+    return;
+  }
+
+  DepsOut << DepsText;
+
+}
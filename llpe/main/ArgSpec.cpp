@@ -31,15 +31,18 @@ using namespace llvm;
 // Read a file into a std::string
 static void readWholeFile(std::string& path, std::string& out, bool addnewline) {
 
-  ErrorOr<std::unique_ptr<MemoryBuffer>> MB = MemoryBuffer::getFile(path);
-  if(std::error_code ec = MB.getError()) {
+  // Use the run's file snapshot, so the analysis cache hashes exactly what we read.
+  std::string errors;
+  const MemoryBuffer* MB = getFileSnapshot(path, errors);
+  if(!MB) {
 
-    errs() << "Failed to load from " << path << ": " << ec.message() << "\n";
+    errs() << "Failed to load from " << path << ": " << errors << "\n";
     exit(1);
 
   }
 
-  out = (*MB)->getBuffer();
+  out = MB->getBuffer();
+  GlobalIHP->specInputFiles.push_back(path);
   if(addnewline && (out.size() == 0 || out[out.size() - 1] != '\n')) {
     out += '\n';
   }  
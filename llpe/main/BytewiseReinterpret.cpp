@@ -25,15 +25,30 @@ using namespace llvm;
 // This represents partial results when bytewise re-interpreting data.
 // The internal byte array is represented as a uint64_t array because
 // this is what the LLVM core reinterpreting function requires.
+// Byte validity is a bitmask, so that combining, skipping already-defined
+// bytes and checking completeness can go a word (64 bytes) at a time.
 
-PartialVal::PartialVal(uint64_t nbytes) : partialBufBytes(nbytes), loadFinished(false) {
+static uint64_t maskWords(uint64_t nbytes) {
+
+  return (nbytes + 63) / 64;
+
+}
+
+// Bits [First, Last) of a mask word, where 0 <= First < Last <= 64.
+static uint64_t wordMask(uint64_t First, uint64_t Last) {
+
+  uint64_t Hi = Last == 64 ? ~(uint64_t)0 : (((uint64_t)1 << Last) - 1);
+  return Hi & ~(((uint64_t)1 << First) - 1);
+
+}
+
+PartialVal::PartialVal(uint64_t nbytes) : partialBufBytes(nbytes), validBytes(0), loadFinished(false) {
 
   uint64_t nqwords = (nbytes + 7) / 8;
   partialBuf = new uint64_t[nqwords];
 
-  partialValidBuf = new bool[nbytes];
-  for(uint64_t i = 0; i < nbytes; ++i)
-    partialValidBuf[i] = false;
+  partialValidMask = new uint64_t[maskWords(nbytes)];
+  memset(partialValidMask, 0, maskWords(nbytes) * sizeof(uint64_t));
 
 }
 
@@ -43,18 +58,19 @@ PartialVal& PartialVal::operator=(const PartialVal& Other) {
     delete[] partialBuf;
     partialBuf = 0;
   }
-  if(partialValidBuf) {
-    delete[] partialValidBuf;
-    partialValidBuf = 0;
+  if(partialValidMask) {
+    delete[] partialValidMask;
+    partialValidMask = 0;
   }
 
   partialBuf = new uint64_t[(Other.partialBufBytes + 7) / 8];
   memcpy(partialBuf, Other.partialBuf, Other.partialBufBytes);
 
-  partialValidBuf = new bool[Other.partialBufBytes];
-  memcpy(partialValidBuf, Other.partialValidBuf, Other.partialBufBytes);
+  partialValidMask = new uint64_t[maskWords(Other.partialBufBytes)];
+  memcpy(partialValidMask, Other.partialValidMask, maskWords(Other.partialBufBytes) * sizeof(uint64_t));
 
   partialBufBytes = Other.partialBufBytes;
+  validBytes = Other.validBytes;
   loadFinished = Other.loadFinished;
 
   return *this;
@@ -64,7 +80,7 @@ PartialVal& PartialVal::operator=(const PartialVal& Other) {
 PartialVal::PartialVal(const PartialVal& Other) {
 
   partialBuf = 0;
-  partialValidBuf = 0;
+  partialValidMask = 0;
   (*this) = Other;
 
 }
@@ -74,8 +90,8 @@ PartialVal::~PartialVal() {
   if(partialBuf) {
     delete[] partialBuf;
   }
-  if(partialValidBuf) {
-    delete[] partialValidBuf;
+  if(partialValidMask) {
+    delete[] partialValidMask;
   }
 
 }
@@ -86,38 +102,62 @@ bool PartialVal::isComplete() {
 
 }
 
-// Copy bytes in from the given buffer, targeting the range (FirstDef-FirstNotDef], marking each valid.
+// Mark bytes [FirstDef, FirstNotDef) valid and note whether that completes the value.
+void PartialVal::markValid(uint64_t FirstDef, uint64_t FirstNotDef) {
+
+  for(uint64_t i = FirstDef; i < FirstNotDef;) {
+
+    uint64_t word = i / 64;
+    uint64_t last = std::min(FirstNotDef - (word * 64), (uint64_t)64);
+    uint64_t bits = wordMask(i % 64, last);
+
+    validBytes += countPopulation(bits & ~partialValidMask[word]);
+    partialValidMask[word] |= bits;
+    i = (word * 64) + last;
+
+  }
+
+  loadFinished = (validBytes == partialBufBytes);
+
+}
+
+// Copy bytes in from the given buffer, targeting the range [FirstDef, FirstNotDef), marking each valid.
+// Bytes that are already defined keep their existing values.
 void PartialVal::combineWith(uint8_t* Other, uint64_t FirstDef, uint64_t FirstNotDef) {
 
   assert(FirstDef < partialBufBytes);
   assert(FirstNotDef <= partialBufBytes);
 
-  // Avoid rewriting bytes which have already been defined
-  for(uint64_t i = 0; i < (FirstNotDef - FirstDef); ++i) {
-    if(partialValidBuf[FirstDef + i]) {
-      continue;
-    }
-    else {
-      ((unsigned char*)partialBuf)[FirstDef + i] = Other[i]; 
-    }
-  }
+  uint8_t* Buf = (uint8_t*)partialBuf;
 
-  loadFinished = true;
-  // Meaning of the predicate: stop at the boundary, or bail out if there's no more setting to do
-  // and there's no hope we've finished.
-  for(uint64_t i = 0; i < partialBufBytes && (loadFinished || i < FirstNotDef); ++i) {
+  for(uint64_t i = FirstDef; i < FirstNotDef;) {
+
+    uint64_t word = i / 64;
+    uint64_t last = std::min(FirstNotDef - (word * 64), (uint64_t)64);
+    uint64_t wanted = wordMask(i % 64, last);
+    uint64_t defined = partialValidMask[word] & wanted;
+
+    if(!defined) {
+
+      // Nothing defined here yet: copy the whole run.
+      memcpy(&Buf[i], &Other[i - FirstDef], (word * 64) + last - i);
 
-    if(i >= FirstDef && i < FirstNotDef) {
-      partialValidBuf[i] = true;
     }
-    else {
-      if(!partialValidBuf[i]) {
-	loadFinished = false;
+    else if(defined != wanted) {
+
+      for(uint64_t j = i, jlim = (word * 64) + last; j != jlim; ++j) {
+	if(!isValid(j))
+	  Buf[j] = Other[j - FirstDef];
       }
+
     }
 
+    i = (word * 64) + last;
+
   }
 
+  markValid(FirstDef, FirstNotDef);
+
 }
 
 void PartialVal::combineWith(PartialVal& Other, uint64_t FirstDef, uint64_t FirstNotDef) {
@@ -126,6 +166,43 @@ void PartialVal::combineWith(PartialVal& Other, uint64_t FirstDef, uint64_t Firs
 
 }
 
+// As combineWith, for a run of bytes all equal to SplatVal.
+void PartialVal::combineWithSplat(uint8_t SplatVal, uint64_t FirstDef, uint64_t FirstNotDef) {
+
+  assert(FirstDef < partialBufBytes);
+  assert(FirstNotDef <= partialBufBytes);
+
+  uint8_t* Buf = (uint8_t*)partialBuf;
+
+  for(uint64_t i = FirstDef; i < FirstNotDef;) {
+
+    uint64_t word = i / 64;
+    uint64_t last = std::min(FirstNotDef - (word * 64), (uint64_t)64);
+    uint64_t wanted = wordMask(i % 64, last);
+    uint64_t defined = partialValidMask[word] & wanted;
+
+    if(!defined) {
+
+      memset(&Buf[i], SplatVal, (word * 64) + last - i);
+
+    }
+    else if(defined != wanted) {
+
+      for(uint64_t j = i, jlim = (word * 64) + last; j != jlim; ++j) {
+	if(!isValid(j))
+	  Buf[j] = SplatVal;
+      }
+
+    }
+
+    i = (word * 64) + last;
+
+  }
+
+  markValid(FirstDef, FirstNotDef);
+
+}
+
 bool PartialVal::combineWith(Constant* C, uint64_t ReadOffset, uint64_t FirstDef, uint64_t FirstNotDef, std::string* error) {
 
   uint8_t* tempBuf = (unsigned char*)alloca(FirstNotDef - FirstDef);
@@ -175,17 +252,7 @@ bool llvm::addIVToPartialVal(const ImprovedVal& IV, ValSetType SetType, uint64_t
 
     // Splat of i8:
     uint8_t SplatVal = (uint8_t)(cast<ConstantInt>(DefC)->getLimitedValue());
-    PartialVal NewPV(Size);
-    
-    uint8_t* buffer = (uint8_t*)NewPV.partialBuf;
-    bool* validBuf = (bool*)NewPV.partialValidBuf;
-    
-    for(uint64_t i = 0; i < Size; ++i) {
-      buffer[i] = SplatVal;
-      validBuf[i] = true;
-    }
-
-    PV->combineWith(NewPV, PVOffset, PVOffset + Size);
+    PV->combineWithSplat(SplatVal, PVOffset, PVOffset + Size);
     return true;
     
   }
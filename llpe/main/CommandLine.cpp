@@ -21,7 +21,8 @@
 using namespace llvm;
 
 // Command-line args. See llpe.org for documentation.
-// One extra arg is declared in TopLevel.cpp: the root function name.
+// A few extra args are declared elsewhere: the root function name and startup report in
+// TopLevel.cpp, the analysis cache directory in AnalysisCache.cpp and the commit server FIFO in CommitServer.cpp.
 
 static cl::opt<std::string> GraphOutputDirectory("llpe-graphs-dir", cl::init(""));
 static cl::opt<std::string> EnvFileAndIdx("spec-env", cl::init(""));
@@ -49,6 +50,8 @@ static cl::opt<bool> SkipBenefitAnalysis("skip-benefit-analysis");
 static cl::opt<bool> SkipDIE("skip-llpe-die");
 static cl::opt<bool> SkipTL("skip-check-elim");
 static cl::opt<unsigned> MaxContexts("llpe-stop-after", cl::init(0));
+static cl::opt<unsigned> TimeBudget("llpe-time-budget", cl::init(0));
+static cl::opt<unsigned> MemoryBudget("llpe-memory-budget", cl::init(0));
 static cl::opt<bool> VerboseOverdef("llpe-verbose-overdef");
 static cl::opt<bool> EnableFunctionSharing("llpe-enable-sharing");
 static cl::opt<bool> VerboseFunctionSharing("llpe-verbose-sharing");
@@ -76,6 +79,10 @@ static cl::opt<bool> OmitChecks("llpe-omit-checks");
 static cl::opt<bool> OmitMallocChecks("llpe-omit-malloc-checks");
 static cl::list<std::string> SplitFunctions("llpe-force-split");
 static cl::opt<bool> EmitFakeDebug("llpe-emit-fake-debug");
+static cl::opt<bool> SparseLoopAnalysis("llpe-sparse-loop-analysis");
+static cl::opt<bool> LoadForwardCache("llpe-load-forward-cache");
+static cl::opt<bool> HeaderMergeCache("llpe-header-merge-cache");
+static cl::opt<unsigned> LoopWidenThreshold("llpe-loop-widen-after", cl::init(0));
 
 static void dieEnvUsage() {
 
@@ -623,6 +630,12 @@ void LLPEAnalysisPass::parseArgs(Function& F, std::vector<Constant*>& argConstan
   this->statsFile = StatsFile;
   this->mallocAlignment = MallocAlignment;
   this->maxContexts = MaxContexts;
+  this->timeBudget = TimeBudget;
+  this->memoryBudget = ((uint64_t)MemoryBudget) * 1024 * 1024;
+  this->sparseLoopAnalysis = SparseLoopAnalysis;
+  this->loadForwardCaching = LoadForwardCache;
+  this->headerMergeCaching = HeaderMergeCache;
+  this->loopWidenThreshold = LoopWidenThreshold;
   
   if(EnvFileAndIdx != "") {
 
@@ -1237,6 +1250,14 @@ void LLPEAnalysisPass::parseArgs(Function& F, std::vector<Constant*>& argConstan
 
 }
 
+// Re-read the options that only take effect at commit time, after a commit server request has changed them.
+void LLPEAnalysisPass::parseCommitArgs() {
+
+  this->statsFile = StatsFile;
+  this->llioConfigFile = LLIOConfFile;
+
+}
+
 void LLPEAnalysisPass::parseArgsPostCreation(InlineAttempt* IA) {
 
   for(cl::list<std::string>::iterator it = IgnoreBlocks.begin(), itend = IgnoreBlocks.end();
@@ -0,0 +1,202 @@
+//===-- CommitServer.cpp --------------------------------------------------===//
+//
+//                                  LLPE
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.txt for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Analysis/LLPE.h"
+
+#include "llvm/IR/Module.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define DEBUG_TYPE "llpe-misc"
+
+using namespace llvm;
+
+// Re-running the root context's commit without re-interpreting the program.
+// This is not a checkpoint: nothing is written to disk, and the analysed tree only lives as long as the
+// server process. The tree is made of pointers into the module, the heap and the value allocators, and
+// child contexts have already emitted their code into the module by the time the root's analysis
+// finishes, so we keep it alive in a server process and fork a fresh copy of it for each commit attempt.
+//
+// Each line read from the server's FIFO has the form "output.bc [-opt[=value] ...]": the child applies
+// the given options, finalises and commits the root and writes the resulting module to output.bc.
+// Only options that are still read at that point are accepted (see commitTimeOptions); anything
+// else has already taken effect during analysis or in the children's commits, so changing it would
+// silently do nothing and the request is refused. A crash during commit only loses that request.
+// The line "quit" stops the server.
+
+static cl::opt<std::string> CommitServerFifo("llpe-commit-server", cl::init(""));
+
+bool LLPEAnalysisPass::commitServerEnabled() {
+
+  return !CommitServerFifo.empty();
+
+}
+
+static const char* commitTimeOptions[] = { "llpe-stats-file", "llpe-write-llio-conf", "int-skip-post-commit" };
+
+static StringRef requestOptionName(StringRef Opt) {
+
+  return Opt.ltrim('-').split('=').first;
+
+}
+
+// Return the first option in a request that can't take effect any more, or an empty string.
+static StringRef findLateOption(ArrayRef<StringRef> Opts) {
+
+  for(uint32_t i = 0, ilim = Opts.size(); i != ilim; ++i) {
+
+    StringRef Name = requestOptionName(Opts[i]);
+    bool found = false;
+    for(uint32_t j = 0, jlim = sizeof(commitTimeOptions) / sizeof(commitTimeOptions[0]); j != jlim && !found; ++j)
+      found = Name == commitTimeOptions[j];
+
+    if(!found)
+      return Opts[i];
+
+  }
+
+  return StringRef();
+
+}
+
+// Apply commit-time options given in a request, resetting any that were already given on our command line.
+static void applyRequestOptions(ArrayRef<StringRef> Opts) {
+
+  if(Opts.empty())
+    return;
+
+  StringMap<cl::Option*>& Registered = cl::getRegisteredOptions();
+
+  std::vector<std::string> Storage;
+  for(uint32_t i = 0, ilim = Opts.size(); i != ilim; ++i) {
+
+    Storage.push_back(Opts[i].str());
+    StringRef Name = requestOptionName(Opts[i]);
+    StringMap<cl::Option*>::iterator findit = Registered.find(Name);
+    if(findit != Registered.end())
+      findit->second->reset();
+
+  }
+
+  std::vector<const char*> Argv;
+  Argv.push_back("llpe-commit");
+  for(uint32_t i = 0, ilim = Storage.size(); i != ilim; ++i)
+    Argv.push_back(Storage[i].c_str());
+
+  cl::ParseCommandLineOptions(Argv.size(), Argv.data());
+
+}
+
+// Called when the root context's analysis is complete. Only returns in a forked child that should go on to
+// commit; the server process itself exits once it receives "quit".
+void LLPEAnalysisPass::runCommitServer() {
+
+  if(IHPSaveDOTFiles) {
+    errs() << "--llpe-commit-server can't be used with the GUI\n";
+    exit(1);
+  }
+
+  errs() << "\nAnalysis complete, waiting for commit requests on " << CommitServerFifo << "\n";
+
+  char* line = 0;
+  size_t linecap = 0;
+
+  while(1) {
+
+    // Reopen on EOF: each writer to the FIFO may close it after sending its requests.
+    FILE* requests = fopen(CommitServerFifo.c_str(), "r");
+    if(!requests) {
+      errs() << "Failed to open " << CommitServerFifo << "\n";
+      exit(1);
+    }
+
+    ssize_t linelen;
+    while((linelen = getline(&line, &linecap, requests)) != -1) {
+
+      SmallVector<StringRef, 8> Args;
+      StringRef(line, linelen).trim().split(Args, ' ', -1, false);
+
+      if(Args.empty())
+	continue;
+
+      if(Args[0] == "quit") {
+	fclose(requests);
+	free(line);
+	_exit(0);
+      }
+
+      StringRef Late = findLateOption(makeArrayRef(Args).slice(1));
+      if(!Late.empty()) {
+	errs() << "Commit server: " << Late << " can't be changed after analysis; ignoring request for " << Args[0] << "\n";
+	continue;
+      }
+
+      errs().flush();
+      pid_t child = fork();
+      if(child == -1) {
+	errs() << "Commit server: fork failed\n";
+	exit(1);
+      }
+
+      if(child == 0) {
+
+	fclose(requests);
+	commitOutputFile = Args[0].str();
+	applyRequestOptions(makeArrayRef(Args).slice(1));
+	free(line);
+	parseCommitArgs();
+	// Variants of one analysis would share a cache key.
+	analysisCacheKey.clear();
+	return;
+
+      }
+
+      int status;
+      if(waitpid(child, &status, 0) == -1) {
+	errs() << "Commit server: waitpid failed\n";
+	exit(1);
+      }
+
+      if(WIFEXITED(status))
+	errs() << "Commit to " << Args[0] << " exited with status " << WEXITSTATUS(status) << "\n";
+      else if(WIFSIGNALED(status))
+	errs() << "Commit to " << Args[0] << " killed by signal " << WTERMSIG(status) << "\n";
+
+    }
+
+    fclose(requests);
+
+  }
+
+}
+
+// Called at the end of commit() in a server child: write the committed module and stop.
+void LLPEAnalysisPass::writeCommitServerOutput(Module& M) {
+
+  {
+    std::error_code EC;
+    raw_fd_ostream Out(commitOutputFile, EC, sys::fs::F_None);
+    if(EC) {
+      errs() << "Failed to open " << commitOutputFile << ": " << EC.message() << "\n";
+      _exit(1);
+    }
+    WriteBitcodeToFile(M, Out);
+  }
+
+  errs().flush();
+  _exit(0);
+
+}
@@ -0,0 +1,1120 @@
+//===-- ConcreteLoop.cpp --------------------------------------------------===//
+//
+//                                  LLPE
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.txt for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Analysis/LLPE.h"
+
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/GetElementPtrTypeIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+
+#define DEBUG_TYPE "llpe-misc"
+
+using namespace llvm;
+
+// Running loops with plain machine values. Peeling a loop that has thousands of known trips builds a
+// PeelIteration per trip, each with its own blocks, per-instruction value sets and copy-on-write stores.
+// With -llpe-concrete-loops, when a loop is reached outside the loop analyser we first try to run it
+// over its invariant instructions with uint64_t integers, (object, offset) pointers and a byte image of
+// each object it touches, copied out of the preheader's store. If that reaches an exit within the
+// budget after at least -llpe-concrete-loop-min-trips trips, the loop isn't peeled: it is analysed
+// for its general case as if peeling had been refused, and once that is done the touched objects'
+// final bytes are written into the exiting block's store and the exit block's PHIs take the values
+// their operands had on the last trip, so code after the loop sees both as constants.
+//
+// If every in-loop value used after the loop is known that way, nothing in the loop needs a runtime
+// check and the objects it wrote can be named from the committed program, commit drops the loop for
+// a block that copies each run of bytes it wrote out of a constant and branches to the exit;
+// otherwise the general loop is kept.
+//
+// Only integer arithmetic, comparisons, casts between integers, GEPs, integer loads and stores,
+// PHIs and branches can be run; reaching anything else (calls, floating point, loading or storing
+// pointers) makes us fall back to peeling. We only touch constant globals and objects no other
+// thread can write, and only handle loops with a single exit edge.
+
+static cl::opt<bool> ConcreteLoops("llpe-concrete-loops", cl::init(false));
+static cl::opt<unsigned> ConcreteLoopMinTrips("llpe-concrete-loop-min-trips", cl::init(64));
+static cl::opt<unsigned> ConcreteLoopMaxSteps("llpe-concrete-loop-max-steps", cl::init(50000000));
+static cl::opt<unsigned> ConcreteLoopMaxObjectBytes("llpe-concrete-loop-max-object-bytes", cl::init(1 << 24));
+
+enum ConcreteValKind {
+
+  CVK_NONE,
+  CVK_INT,
+  CVK_PTR,
+  CVK_NULL
+
+};
+
+struct ConcreteVal {
+
+  ConcreteValKind kind;
+  // The integer, or the pointer's offset:
+  uint64_t val;
+  // Index into ConcreteLoopRun::objects for pointers.
+  uint32_t obj;
+
+  ConcreteVal() : kind(CVK_NONE), val(0), obj(0) { }
+  ConcreteVal(ConcreteValKind k, uint64_t v, uint32_t o = 0) : kind(k), val(v), obj(o) { }
+
+};
+
+struct ConcreteObject {
+
+  ShadowValue V;
+  bool loaded;
+  bool readOnly;
+  uint64_t size;
+  std::vector<uint8_t> bytes;
+  BitVector valid;
+  // Bytes stored to by the loop, as opposed to carried over from before it.
+  BitVector written;
+  bool anyWritten;
+
+  ConcreteObject(ShadowValue _V) : V(_V), loaded(false), readOnly(false), size(0), anyWritten(false) { }
+
+};
+
+// One instruction, resolved against the loop's own numbering. Operand references index
+// ConcreteLoopRun::vals if non-negative, or else ConcreteLoopRun::consts[-ref - 1].
+struct ConcreteInst {
+
+  Instruction* I;
+  // False if we can't run this instruction; we only give up if it is reached.
+  bool ok;
+  uint32_t slot;
+  uint32_t firstOp;
+  uint32_t nOps;
+  // Result width in bits for integers; byte size for loads and stores; constant offset for GEPs;
+  // first case for switches.
+  uint64_t aux;
+
+};
+
+struct ConcreteBlock {
+
+  ShadowBBInvar* BBI;
+  uint32_t firstInst;
+  uint32_t nPhis;
+  uint32_t nInsts;
+
+};
+
+struct llvm::ConcreteLoopRun {
+
+  const ShadowLoopInvar* L;
+  ShadowBB* PHBB;
+
+  std::vector<ConcreteObject> objects;
+  DenseMap<ShadowValue, uint32_t> objectIdx;
+
+  std::vector<ConcreteVal> consts;
+  std::vector<ConcreteVal> vals;
+  std::vector<uint32_t> slotBase;
+
+  std::vector<ConcreteInst> insts;
+  std::vector<ConcreteBlock> blocks;
+  std::vector<int32_t> opRefs;
+  // Parallel to opRefs: incoming block for PHIs, scale for GEP indices.
+  std::vector<int64_t> opAux;
+  std::vector<std::pair<uint64_t, uint32_t> > switchCases;
+
+  uint32_t exitFrom;
+  uint32_t exitTo;
+  uint64_t trips;
+
+  ConcreteLoopRun(const ShadowLoopInvar* _L, ShadowBB* _PHBB) : L(_L), PHBB(_PHBB), exitFrom(0), exitTo(0), trips(0) { }
+
+  bool inLoop(uint32_t idx) {
+    return idx >= L->headerIdx && idx < L->headerIdx + L->nBlocks;
+  }
+
+  uint32_t getObject(ShadowValue V);
+  bool ensureLoaded(ConcreteObject& O);
+  bool resolveOperand(IntegrationAttempt* IA, ShadowInstructionInvar* SII, uint32_t i, int32_t& Ref);
+  bool compileInst(IntegrationAttempt* IA, ShadowInstructionInvar* SII, ConcreteInst& CI);
+  void compile(IntegrationAttempt* IA);
+  bool run();
+  bool execInst(ConcreteInst& CI, ConcreteVal& Result);
+  bool access(const ConcreteVal& Ptr, uint64_t Size, bool isWrite, ConcreteObject*& O);
+  bool getExitValue(const ConcreteVal& CV, Type* Ty, ImprovedValSetSingle& IVS);
+  void findExitValues(IntegrationAttempt* IA, ConcreteLoopResult* Result);
+
+  const ConcreteVal& getOp(const ConcreteInst& CI, uint32_t i) {
+    int32_t ref = opRefs[CI.firstOp + i];
+    return ref >= 0 ? vals[ref] : consts[-ref - 1];
+  }
+
+};
+
+static inline uint64_t widthMask(uint64_t width) {
+  return width >= 64 ? ~(uint64_t)0 : (((uint64_t)1 << width) - 1);
+}
+
+static inline int64_t signExtend(uint64_t val, uint64_t width) {
+  return width >= 64 ? (int64_t)val : ((int64_t)(val << (64 - width))) >> (64 - width);
+}
+
+// Integer width of Ty if we can represent it, or 0.
+static uint64_t getConcreteWidth(Type* Ty) {
+
+  if(IntegerType* ITy = dyn_cast<IntegerType>(Ty)) {
+    if(ITy->getBitWidth() <= 64)
+      return ITy->getBitWidth();
+  }
+
+  return 0;
+
+}
+
+uint32_t ConcreteLoopRun::getObject(ShadowValue V) {
+
+  DenseMap<ShadowValue, uint32_t>::iterator findit = objectIdx.find(V);
+  if(findit != objectIdx.end())
+    return findit->second;
+
+  uint32_t idx = objects.size();
+  objects.push_back(ConcreteObject(V));
+  objectIdx[V] = idx;
+  return idx;
+
+}
+
+// Copy O's known bytes out of the preheader store the first time it is accessed.
+bool ConcreteLoopRun::ensureLoaded(ConcreteObject& O) {
+
+  if(O.loaded)
+    return true;
+
+  if(ShadowGV* G = O.V.getGV()) {
+    O.readOnly = G->G->isConstant();
+  }
+  else if(!O.V.isPtrIdx()) {
+    return false;
+  }
+  else if(O.V.getAllocData(PHBB->localStore)->allocVague) {
+    return false;
+  }
+
+  if((!O.readOnly) && (!GlobalIHP->programSingleThreaded) && !PHBB->localStore->es.threadLocalObjects.count(O.V))
+    return false;
+
+  O.size = PHBB->getAllocSize(O.V);
+  if(O.size == 0 || O.size > ConcreteLoopMaxObjectBytes)
+    return false;
+
+  SmallVector<IVSRange, 4> Vals;
+  readValRangeMulti(O.V, 0, O.size, PHBB, Vals);
+
+  PartialVal PV(O.size);
+  for(SmallVector<IVSRange, 4>::iterator it = Vals.begin(), itend = Vals.end(); it != itend; ++it) {
+
+    // Never-written bytes stay unknown.
+    const ImprovedValSetSingle& IVS = it->second;
+    if(IVS.Values.size() == 1 && IVS.Values[0].V.isVal() && isa<UndefValue>(IVS.Values[0].V.getVal()))
+      continue;
+
+    addIVSToPartialVal(IVS, 0, it->first.first, it->first.second - it->first.first, &PV, 0);
+
+  }
+
+  uint8_t* Buf = (uint8_t*)PV.partialBuf;
+  O.bytes.assign(Buf, Buf + O.size);
+  O.valid.resize(O.size);
+  O.written.resize(O.size);
+  for(uint64_t i = 0; i != O.size; ++i) {
+    if(PV.isValid(i))
+      O.valid.set(i);
+  }
+
+  O.loaded = true;
+  return true;
+
+}
+
+// Find the value of an operand defined outside the loop, as ShadowInstruction::getOperand would.
+bool ConcreteLoopRun::resolveOperand(IntegrationAttempt* IA, ShadowInstructionInvar* SII, uint32_t i, int32_t& Ref) {
+
+  ShadowInstIdx& OpIdx = SII->operandIdxs[i];
+  if(OpIdx.blockIdx != INVALID_BLOCK_IDX && inLoop(OpIdx.blockIdx)) {
+    Ref = slotBase[OpIdx.blockIdx - L->headerIdx] + OpIdx.instIdx;
+    return true;
+  }
+
+  Value* ArgV = SII->I->getOperand(i);
+  ShadowValue SV;
+
+  if(OpIdx.blockIdx == INVALID_BLOCK_IDX) {
+
+    if(OpIdx.instIdx != INVALID_INSTRUCTION_IDX)
+      SV = ShadowValue(&(IA->pass->shadowGlobals[OpIdx.instIdx]));
+    else if(Argument* A = dyn_cast<Argument>(ArgV))
+      SV = ShadowValue(&(IA->getFunctionRoot()->argShadows[A->getArgNo()]));
+    else
+      SV = ShadowValue(ArgV);
+
+  }
+  else if(OpIdx.instIdx == INVALID_INSTRUCTION_IDX) {
+    return false;
+  }
+  else {
+
+    ShadowInstruction* OpInst = IA->getInst(OpIdx.blockIdx, OpIdx.instIdx);
+    if(!OpInst)
+      return false;
+    SV = ShadowValue(OpInst);
+
+  }
+
+  ImprovedValSetSingle IVS;
+  if((!getImprovedValSetSingle(SV, IVS)) || IVS.isWhollyUnknown() || IVS.Values.size() != 1)
+    return false;
+
+  ImprovedVal& IV = IVS.Values[0];
+  ConcreteVal CV;
+
+  if(ArgV->getType()->isPointerTy()) {
+
+    if(IV.V.isNullPointer())
+      CV = ConcreteVal(CVK_NULL, 0);
+    else if(IVS.SetType == ValSetTypePB && IV.Offset != LLONG_MAX)
+      CV = ConcreteVal(CVK_PTR, (uint64_t)IV.Offset, getObject(IV.V));
+    else
+      return false;
+
+  }
+  else {
+
+    uint64_t width = getConcreteWidth(ArgV->getType());
+    uint64_t val;
+    if((!width) || IVS.SetType != ValSetTypeScalar || !tryGetConstantInt(IV.V, val))
+      return false;
+    CV = ConcreteVal(CVK_INT, val & widthMask(width));
+
+  }
+
+  consts.push_back(CV);
+  Ref = -(int32_t)consts.size();
+  return true;
+
+}
+
+bool ConcreteLoopRun::compileInst(IntegrationAttempt* IA, ShadowInstructionInvar* SII, ConcreteInst& CI) {
+
+  Instruction* I = SII->I;
+  CI.I = I;
+  CI.firstOp = opRefs.size();
+  CI.nOps = 0;
+  CI.aux = 0;
+
+  // Resolve every operand up front, except for basic blocks. Debug intrinsics are the only calls we can run.
+  if(isa<DbgInfoIntrinsic>(I))
+    return true;
+
+  uint32_t nOps = isa<BranchInst>(I) ? (cast<BranchInst>(I)->isConditional() ? 1 : 0) :
+    isa<SwitchInst>(I) ? 1 : SII->operandIdxs.size();
+
+  for(uint32_t i = 0; i != nOps; ++i) {
+
+    // An operand we can't resolve only matters if it is used, e.g. a PHI's undef on a path not taken.
+    int32_t Ref;
+    if(!resolveOperand(IA, SII, i, Ref)) {
+      consts.push_back(ConcreteVal());
+      Ref = -(int32_t)consts.size();
+    }
+
+    opRefs.push_back(Ref);
+    opAux.push_back(isa<PHINode>(I) ? SII->operandBBs[i] : 0);
+    ++CI.nOps;
+
+  }
+
+  Type* Ty = I->getType();
+
+  switch(I->getOpcode()) {
+
+  case Instruction::PHI:
+  case Instruction::Select:
+    if(!(Ty->isPointerTy() || (CI.aux = getConcreteWidth(Ty))))
+      return false;
+    return true;
+
+  case Instruction::Add:
+  case Instruction::Sub:
+  case Instruction::Mul:
+  case Instruction::UDiv:
+  case Instruction::SDiv:
+  case Instruction::URem:
+  case Instruction::SRem:
+  case Instruction::Shl:
+  case Instruction::LShr:
+  case Instruction::AShr:
+  case Instruction::And:
+  case Instruction::Or:
+  case Instruction::Xor:
+  case Instruction::Trunc:
+  case Instruction::ZExt:
+  case Instruction::SExt:
+    CI.aux = getConcreteWidth(Ty);
+    return CI.aux != 0 && getConcreteWidth(I->getOperand(0)->getType()) != 0;
+
+  case Instruction::ICmp:
+    CI.aux = getConcreteWidth(I->getOperand(0)->getType());
+    return CI.aux != 0 || I->getOperand(0)->getType()->isPointerTy();
+
+  case Instruction::BitCast:
+    if(Ty->isPointerTy())
+      return I->getOperand(0)->getType()->isPointerTy();
+    CI.aux = getConcreteWidth(Ty);
+    return CI.aux != 0 && getConcreteWidth(I->getOperand(0)->getType()) == CI.aux;
+
+  case Instruction::GetElementPtr:
+    {
+      if(!Ty->isPointerTy())
+	return false;
+
+      // Fold struct field offsets into aux; record a scale for each array index.
+      GetElementPtrInst* GEP = cast<GetElementPtrInst>(I);
+      int64_t constOffset = 0;
+      uint32_t opIdx = 1;
+      for(gep_type_iterator GTI = gep_type_begin(GEP), GTIE = gep_type_end(GEP); GTI != GTIE; ++GTI, ++opIdx) {
+
+	if(StructType* STy = GTI.getStructTypeOrNull()) {
+	  uint64_t field = cast<ConstantInt>(GEP->getOperand(opIdx))->getZExtValue();
+	  constOffset += GlobalTD->getStructLayout(STy)->getElementOffset(field);
+	}
+	else {
+	  if(!getConcreteWidth(GEP->getOperand(opIdx)->getType()))
+	    return false;
+	  opAux[CI.firstOp + opIdx] = GlobalTD->getTypeAllocSize(GTI.getIndexedType());
+	}
+
+      }
+
+      CI.aux = (uint64_t)constOffset;
+      return true;
+    }
+
+  case Instruction::Load:
+    {
+      LoadInst* LI = cast<LoadInst>(I);
+      uint64_t width = getConcreteWidth(Ty);
+      if(LI->isVolatile() || LI->isAtomic() || (!width) || (width % 8))
+	return false;
+      CI.aux = width / 8;
+      return true;
+    }
+
+  case Instruction::Store:
+    {
+      StoreInst* StI = cast<StoreInst>(I);
+      uint64_t width = getConcreteWidth(StI->getValueOperand()->getType());
+      if(StI->isVolatile() || StI->isAtomic() || (!width) || (width % 8))
+	return false;
+      CI.aux = width / 8;
+      return true;
+    }
+
+  case Instruction::Br:
+    return true;
+
+  case Instruction::Switch:
+    {
+      SwitchInst* SwI = cast<SwitchInst>(I);
+      if(!getConcreteWidth(SwI->getCondition()->getType()))
+	return false;
+      CI.aux = switchCases.size();
+      for(SwitchInst::CaseIt it = SwI->case_begin(), itend = SwI->case_end(); it != itend; ++it) {
+	uint64_t caseVal = it->getCaseValue()->getZExtValue();
+	switchCases.push_back(std::make_pair(caseVal, SII->parent->succIdxs[it->getSuccessorIndex()]));
+      }
+      return true;
+    }
+
+  default:
+    return false;
+
+  }
+
+}
+
+void ConcreteLoopRun::compile(IntegrationAttempt* IA) {
+
+  uint32_t nSlots = 0;
+  for(uint32_t i = 0; i != L->nBlocks; ++i) {
+    slotBase.push_back(nSlots);
+    nSlots += IA->getBBInvar(L->headerIdx + i)->insts.size();
+  }
+
+  vals.resize(nSlots);
+
+  for(uint32_t i = 0; i != L->nBlocks; ++i) {
+
+    ShadowBBInvar* BBI = IA->getBBInvar(L->headerIdx + i);
+    ConcreteBlock CB;
+    CB.BBI = BBI;
+    CB.firstInst = insts.size();
+    CB.nPhis = 0;
+    CB.nInsts = BBI->insts.size();
+
+    for(uint32_t j = 0, jlim = BBI->insts.size(); j != jlim; ++j) {
+
+      ShadowInstructionInvar* SII = &(BBI->insts[j]);
+      if(isa<PHINode>(SII->I))
+	++CB.nPhis;
+
+      ConcreteInst CI;
+      CI.slot = slotBase[i] + j;
+      CI.ok = compileInst(IA, SII, CI);
+      insts.push_back(CI);
+
+    }
+
+    blocks.push_back(CB);
+
+  }
+
+}
+
+// Check a Size-byte access through Ptr is in bounds of an object we may use.
+bool ConcreteLoopRun::access(const ConcreteVal& Ptr, uint64_t Size, bool isWrite, ConcreteObject*& O) {
+
+  if(Ptr.kind != CVK_PTR)
+    return false;
+
+  O = &objects[Ptr.obj];
+  if(!ensureLoaded(*O))
+    return false;
+
+  if(isWrite && O->readOnly)
+    return false;
+
+  int64_t Offset = (int64_t)Ptr.val;
+  return Offset >= 0 && (uint64_t)Offset + Size <= O->size;
+
+}
+
+bool ConcreteLoopRun::execInst(ConcreteInst& CI, ConcreteVal& Result) {
+
+  Instruction* I = CI.I;
+  uint64_t width = CI.aux;
+  uint64_t mask = widthMask(width);
+
+  switch(I->getOpcode()) {
+
+  case Instruction::Select:
+    {
+      const ConcreteVal& Cond = getOp(CI, 0);
+      if(Cond.kind != CVK_INT)
+	return false;
+      Result = getOp(CI, Cond.val ? 1 : 2);
+      return Result.kind != CVK_NONE;
+    }
+
+  case Instruction::Trunc:
+  case Instruction::ZExt:
+  case Instruction::SExt:
+  case Instruction::BitCast:
+    {
+      const ConcreteVal& Op = getOp(CI, 0);
+      if(Op.kind == CVK_NONE)
+	return false;
+      if(I->getOpcode() == Instruction::SExt)
+	Result = ConcreteVal(CVK_INT, (uint64_t)signExtend(Op.val, getConcreteWidth(I->getOperand(0)->getType())) & mask);
+      else if(Op.kind == CVK_INT)
+	Result = ConcreteVal(CVK_INT, Op.val & mask);
+      else
+	Result = Op;
+      return true;
+    }
+
+  case Instruction::ICmp:
+    {
+      const ConcreteVal& A = getOp(CI, 0);
+      const ConcreteVal& B = getOp(CI, 1);
+      if(A.kind == CVK_NONE || B.kind == CVK_NONE)
+	return false;
+
+      CmpInst::Predicate Pred = cast<ICmpInst>(I)->getPredicate();
+      uint64_t a = A.val, b = B.val;
+
+      if(A.kind != CVK_INT) {
+
+	// Only pointers into the same object, or null, can be ordered.
+	if(A.kind != B.kind || (A.kind == CVK_PTR && A.obj != B.obj)) {
+	  if(Pred == CmpInst::ICMP_EQ || Pred == CmpInst::ICMP_NE) {
+	    Result = ConcreteVal(CVK_INT, Pred == CmpInst::ICMP_NE);
+	    return true;
+	  }
+	  return false;
+	}
+
+	width = 64;
+
+      }
+
+      bool res;
+      int64_t sa = signExtend(a, width), sb = signExtend(b, width);
+
+      switch(Pred) {
+      case CmpInst::ICMP_EQ: res = a == b; break;
+      case CmpInst::ICMP_NE: res = a != b; break;
+      case CmpInst::ICMP_UGT: res = a > b; break;
+      case CmpInst::ICMP_UGE: res = a >= b; break;
+      case CmpInst::ICMP_ULT: res = a < b; break;
+      case CmpInst::ICMP_ULE: res = a <= b; break;
+      case CmpInst::ICMP_SGT: res = sa > sb; break;
+      case CmpInst::ICMP_SGE: res = sa >= sb; break;
+      case CmpInst::ICMP_SLT: res = sa < sb; break;
+      case CmpInst::ICMP_SLE: res = sa <= sb; break;
+      default: return false;
+      }
+
+      Result = ConcreteVal(CVK_INT, res);
+      return true;
+    }
+
+  case Instruction::GetElementPtr:
+    {
+      const ConcreteVal& Base = getOp(CI, 0);
+      if(Base.kind != CVK_PTR)
+	return false;
+
+      int64_t Offset = (int64_t)Base.val + (int64_t)CI.aux;
+      for(uint32_t i = 1; i != CI.nOps; ++i) {
+	const ConcreteVal& Idx = getOp(CI, i);
+	if(Idx.kind != CVK_INT)
+	  return false;
+	int64_t scale = opAux[CI.firstOp + i];
+	if(!scale)
+	  continue;
+	Offset += signExtend(Idx.val, getConcreteWidth(I->getOperand(i)->getType())) * scale;
+      }
+
+      Result = ConcreteVal(CVK_PTR, (uint64_t)Offset, Base.obj);
+      return true;
+    }
+
+  case Instruction::Load:
+    {
+      ConcreteObject* O;
+      const ConcreteVal& Ptr = getOp(CI, 0);
+      if(!access(Ptr, CI.aux, false, O))
+	return false;
+
+      uint64_t val = 0;
+      for(uint64_t i = CI.aux; i != 0; --i) {
+	if(!O->valid[Ptr.val + i - 1])
+	  return false;
+	val = (val << 8) | O->bytes[Ptr.val + i - 1];
+      }
+
+      Result = ConcreteVal(CVK_INT, val);
+      return true;
+    }
+
+  case Instruction::Store:
+    {
+      ConcreteObject* O;
+      const ConcreteVal& Val = getOp(CI, 0);
+      const ConcreteVal& Ptr = getOp(CI, 1);
+      if(Val.kind != CVK_INT || !access(Ptr, CI.aux, true, O))
+	return false;
+
+      uint64_t val = Val.val;
+      for(uint64_t i = 0; i != CI.aux; ++i, val >>= 8) {
+	O->bytes[Ptr.val + i] = (uint8_t)val;
+	O->valid.set(Ptr.val + i);
+	O->written.set(Ptr.val + i);
+      }
+
+      O->anyWritten = true;
+      return true;
+    }
+
+  case Instruction::Call:
+    // Debug intrinsic.
+    return true;
+
+  default:
+    break;
+
+  }
+
+  // Integer binary operators:
+  const ConcreteVal& A = getOp(CI, 0);
+  const ConcreteVal& B = getOp(CI, 1);
+  if(A.kind != CVK_INT || B.kind != CVK_INT)
+    return false;
+
+  uint64_t a = A.val, b = B.val, res;
+  int64_t sa = signExtend(a, width), sb = signExtend(b, width);
+
+  switch(I->getOpcode()) {
+
+  case Instruction::Add: res = a + b; break;
+  case Instruction::Sub: res = a - b; break;
+  case Instruction::Mul: res = a * b; break;
+  case Instruction::And: res = a & b; break;
+  case Instruction::Or: res = a | b; break;
+  case Instruction::Xor: res = a ^ b; break;
+
+  case Instruction::UDiv:
+  case Instruction::URem:
+    if(!b)
+      return false;
+    res = I->getOpcode() == Instruction::UDiv ? a / b : a % b;
+    break;
+
+  case Instruction::SDiv:
+  case Instruction::SRem:
+    // Division by zero or INT_MIN / -1 is undefined.
+    if((!b) || (sb == -1 && a == ((uint64_t)1 << (width - 1))))
+      return false;
+    res = (uint64_t)(I->getOpcode() == Instruction::SDiv ? sa / sb : sa % sb);
+    break;
+
+  case Instruction::Shl:
+  case Instruction::LShr:
+  case Instruction::AShr:
+    if(b >= width)
+      return false;
+    if(I->getOpcode() == Instruction::Shl)
+      res = a << b;
+    else if(I->getOpcode() == Instruction::LShr)
+      res = a >> b;
+    else
+      res = (uint64_t)(sa >> b);
+    break;
+
+  default:
+    return false;
+
+  }
+
+  Result = ConcreteVal(CVK_INT, res & mask);
+  return true;
+
+}
+
+// Run from the header until control leaves the loop, or give up.
+bool ConcreteLoopRun::run() {
+
+  uint64_t steps = 0;
+  uint32_t prev = L->preheaderIdx;
+  uint32_t cur = L->headerIdx;
+  SmallVector<ConcreteVal, 8> newPhis;
+
+  while(1) {
+
+    if(cur == L->headerIdx)
+      ++trips;
+
+    ConcreteBlock& CB = blocks[cur - L->headerIdx];
+
+    // PHIs read their incoming values simultaneously.
+    newPhis.clear();
+    for(uint32_t i = 0; i != CB.nPhis; ++i) {
+
+      ConcreteInst& CI = insts[CB.firstInst + i];
+      if(!CI.ok)
+	return false;
+      uint32_t j = 0;
+      while(j != CI.nOps && opAux[CI.firstOp + j] != (int64_t)prev)
+	++j;
+      if(j == CI.nOps)
+	return false;
+      newPhis.push_back(getOp(CI, j));
+      if(newPhis.back().kind == CVK_NONE)
+	return false;
+
+    }
+
+    for(uint32_t i = 0; i != CB.nPhis; ++i)
+      vals[insts[CB.firstInst + i].slot] = newPhis[i];
+
+    for(uint32_t i = CB.nPhis; i + 1 < CB.nInsts; ++i) {
+
+      ConcreteInst& CI = insts[CB.firstInst + i];
+      if((!CI.ok) || !execInst(CI, vals[CI.slot]))
+	return false;
+
+    }
+
+    steps += CB.nInsts;
+    if(steps > ConcreteLoopMaxSteps)
+      return false;
+
+    // Find the successor:
+    ConcreteInst& Term = insts[CB.firstInst + CB.nInsts - 1];
+    if(!Term.ok)
+      return false;
+
+    ImmutableArray<uint32_t>& Succs = CB.BBI->succIdxs;
+    uint32_t next;
+
+    if(BranchInst* BI = dyn_cast<BranchInst>(Term.I)) {
+
+      if(BI->isConditional()) {
+	const ConcreteVal& Cond = getOp(Term, 0);
+	if(Cond.kind != CVK_INT)
+	  return false;
+	next = Cond.val ? Succs[0] : Succs[1];
+      }
+      else {
+	next = Succs[0];
+      }
+
+    }
+    else {
+
+      const ConcreteVal& Cond = getOp(Term, 0);
+      if(Cond.kind != CVK_INT)
+	return false;
+
+      next = Succs[0];
+      uint32_t nCases = cast<SwitchInst>(Term.I)->getNumCases();
+      for(uint32_t i = 0; i != nCases; ++i) {
+	if(switchCases[Term.aux + i].first == Cond.val) {
+	  next = switchCases[Term.aux + i].second;
+	  break;
+	}
+      }
+
+    }
+
+    if(!inLoop(next)) {
+      exitFrom = cur;
+      exitTo = next;
+      return true;
+    }
+
+    prev = cur;
+    cur = next;
+
+  }
+
+}
+
+// Translate a value the run computed into the form the rest of the analysis uses.
+bool ConcreteLoopRun::getExitValue(const ConcreteVal& CV, Type* Ty, ImprovedValSetSingle& IVS) {
+
+  switch(CV.kind) {
+
+  case CVK_INT:
+    IVS = ImprovedValSetSingle(ImprovedVal(ShadowValue::getInt(Ty, CV.val)), ValSetTypeScalar);
+    return true;
+
+  case CVK_NULL:
+    {
+      std::pair<ValSetType, ImprovedVal> Null = getValPB(Constant::getNullValue(Ty));
+      IVS = ImprovedValSetSingle(Null.second, Null.first);
+      return true;
+    }
+
+  case CVK_PTR:
+    IVS = ImprovedValSetSingle(ImprovedVal(objects[CV.obj].V, (int64_t)CV.val), ValSetTypePB);
+    return true;
+
+  default:
+    return false;
+
+  }
+
+}
+
+// Note the value each exit PHI's in-loop operand had on the last trip, which is the PHI's value as
+// the exit block has no other predecessor. Any other use of an in-loop value after the loop, or
+// one we didn't compute, means the loop has to stay.
+void ConcreteLoopRun::findExitValues(IntegrationAttempt* IA, ConcreteLoopResult* Result) {
+
+  ShadowBBInvar* XI = IA->getBBInvar(exitTo);
+  if(XI->predIdxs.size() != 1) {
+    Result->canReplace = false;
+    return;
+  }
+
+  for(uint32_t i = 0; i != L->nBlocks; ++i) {
+
+    ShadowBBInvar* BBI = IA->getBBInvar(L->headerIdx + i);
+
+    for(uint32_t j = 0, jlim = BBI->insts.size(); j != jlim; ++j) {
+
+      ShadowInstructionInvar& SII = BBI->insts[j];
+
+      for(uint32_t k = 0, klim = SII.userIdxs.size(); k != klim; ++k) {
+
+	ShadowInstIdx& User = SII.userIdxs[k];
+	if(User.blockIdx != INVALID_BLOCK_IDX && inLoop(User.blockIdx))
+	  continue;
+
+	ImprovedValSetSingle IVS;
+	if(User.blockIdx != exitTo || User.instIdx == INVALID_INSTRUCTION_IDX || 
+	   (!isa<PHINode>(XI->insts[User.instIdx].I)) || !getExitValue(vals[slotBase[i] + j], SII.I->getType(), IVS)) {
+	  Result->canReplace = false;
+	  continue;
+	}
+
+	Result->exitPHIValues.push_back(std::make_pair(User.instIdx, IVS));
+
+      }
+
+    }
+
+  }
+
+}
+
+// Called on reaching loop L outside the loop analyser, before deciding whether to peel it.
+// Returns a completed run to be applied by applyConcreteLoopRun once the general case has been
+// analysed, or null if the loop should be peeled as usual.
+ConcreteLoopRun* IntegrationAttempt::runLoopConcretely(const ShadowLoopInvar* L) {
+
+  if(!ConcreteLoops)
+    return 0;
+
+  // Forget any result from an earlier analysis of this loop.
+  DenseMap<const ShadowLoopInvar*, ConcreteLoopResult*>::iterator findit = concreteLoops.find(L);
+  if(findit != concreteLoops.end()) {
+    delete findit->second;
+    concreteLoops.erase(findit);
+  }
+
+  if(pass->shouldIgnoreLoop(&F, getBBInvar(L->headerIdx)->BB) || getPeelAttempt(L))
+    return 0;
+
+  if(!GlobalTD->isLittleEndian())
+    return 0;
+
+  // The result goes into the store on the loop's only exit edge, which must leave
+  // from the loop's own scope into ours.
+  if(L->exitEdges.size() != 1 ||
+     getBBInvar(L->exitEdges[0].first)->naturalScope != L ||
+     getBBInvar(L->exitEdges[0].second)->naturalScope != L->parent)
+    return 0;
+
+  ShadowBB* PHBB = getBB(L->preheaderIdx);
+  if((!PHBB) || !PHBB->isMarkedCertainOrAssumed())
+    return 0;
+
+  ConcreteLoopRun* Run = new ConcreteLoopRun(L, PHBB);
+  Run->compile(this);
+  if(!(Run->run() && Run->trips >= ConcreteLoopMinTrips)) {
+
+    LLVM_DEBUG(dbgs() << "Peeling loop " << getBBInvar(L->headerIdx)->BB->getName() << " after " << Run->trips << " concrete trips\n");
+    delete Run;
+    return 0;
+
+  }
+
+  LLVM_DEBUG(dbgs() << "Ran loop " << getBBInvar(L->headerIdx)->BB->getName() << " concretely for " << Run->trips << " trips\n");
+  return Run;
+
+}
+
+// The general case of Run's loop has been analysed: overwrite the exiting block's store with
+// the final contents of every object the loop wrote, and record the loop's exit values and
+// writes for the exit block and commit. Frees Run.
+void IntegrationAttempt::applyConcreteLoopRun(ConcreteLoopRun* Run) {
+
+  ShadowBB* E = getBB(Run->exitFrom);
+  ShadowBBInvar* XI = getBBInvar(Run->exitTo);
+
+  // The exit edge holds one reference to E's store, which we take over as a block writing its store would.
+  bool usable = E && E->localStore && !edgeBranchesToUnspecialisedCode(E->invar, XI);
+  if(usable) {
+
+    uint32_t nEdges = 0;
+    for(uint32_t i = 0, ilim = E->invar->succIdxs.size(); i != ilim; ++i) {
+      if(E->invar->succIdxs[i] == Run->exitTo) {
+	++nEdges;
+	usable &= E->succsAlive[i];
+      }
+    }
+
+    usable &= (nEdges == 1);
+
+  }
+
+  if(usable) {
+
+    LLVMContext& Ctx = F.getContext();
+    ConcreteLoopResult* Result = new ConcreteLoopResult(Run->exitFrom, Run->exitTo);
+
+    for(std::vector<ConcreteObject>::iterator it = Run->objects.begin(), itend = Run->objects.end(); it != itend; ++it) {
+
+      if(!it->loaded)
+	continue;
+
+      noteDependency(it->V);
+
+      if(!it->anyWritten)
+	continue;
+
+      // Write each run of known bytes, whether written by the loop or carried over from before it.
+      int a = it->valid.find_first();
+      while(a != -1) {
+
+	int b = it->valid.find_next_unset(a);
+	if(b == -1)
+	  b = it->size;
+
+	ArrayRef<uint8_t> Bytes(&(it->bytes[a]), b - a);
+	ImprovedValSetSingle IVS(ImprovedVal(ConstantDataArray::get(Ctx, Bytes), 0), ValSetTypeScalar);
+
+	if(LocStore* Store = E->getWritableStoreFor(it->V, a, b - a, true))
+	  replaceRangeWithPB(Store->store, IVS, a, b - a);
+
+	a = ((uint64_t)b == it->size) ? -1 : it->valid.find_next(b);
+
+      }
+
+      // Only the bytes the loop wrote need writing if it is dropped.
+      a = it->written.find_first();
+      while(a != -1) {
+
+	int b = it->written.find_next_unset(a);
+	if(b == -1)
+	  b = it->size;
+
+	ArrayRef<uint8_t> Bytes(&(it->bytes[a]), b - a);
+	Result->writes.push_back(std::make_pair(ImprovedVal(it->V, a), ConstantDataArray::get(Ctx, Bytes)));
+
+	a = ((uint64_t)b == it->size) ? -1 : it->written.find_next(b);
+
+      }
+
+    }
+
+    Run->findExitValues(this, Result);
+    concreteLoops[Run->L] = Result;
+
+    ++pass->stats.concreteLoops;
+    pass->stats.concreteLoopTrips += Run->trips;
+
+  }
+
+  delete Run;
+
+}
+
+ConcreteLoopResult* IntegrationAttempt::getConcreteLoopResult(const ShadowLoopInvar* LoopL) {
+
+  DenseMap<const ShadowLoopInvar*, ConcreteLoopResult*>::iterator findit = concreteLoops.find(LoopL);
+  if(findit == concreteLoops.end())
+    return 0;
+  return findit->second;
+
+}
+
+// If SI is a PHI in the exit block of a loop we ran concretely, give it the final value of its operand.
+bool IntegrationAttempt::tryEvaluateConcreteExitPHI(ShadowInstruction* SI, ImprovedValSet*& NewPB) {
+
+  if(concreteLoops.empty())
+    return false;
+
+  ShadowInstructionInvar* SII = SI->invar;
+  if(SII->operandBBs.size() != 1)
+    return false;
+
+  const ShadowLoopInvar* OpL = getBBInvar(SII->operandBBs[0])->naturalScope;
+  if((!OpL) || OpL == L || (L && !L->contains(OpL)))
+    return false;
+
+  ConcreteLoopResult* Result = getConcreteLoopResult(immediateChildLoop(L, OpL));
+  if((!Result) || Result->exitTo != SII->parent->idx)
+    return false;
+
+  for(uint32_t i = 0, ilim = Result->exitPHIValues.size(); i != ilim; ++i) {
+
+    if(Result->exitPHIValues[i].first == SII->idx) {
+      NewPB = copyIVS(&Result->exitPHIValues[i].second);
+      return true;
+    }
+
+  }
+
+  return false;
+
+}
+
+// Decide at commit time whether LoopL, which ran concretely, can be replaced by its writes. Nothing
+// in it may need a runtime check or branch to unspecialised code, the objects it wrote must be
+// available here, and the exit block's PHIs must not need to refer to it.
+bool IntegrationAttempt::canReplaceConcreteLoop(const ShadowLoopInvar* LoopL, ConcreteLoopResult* Result) {
+
+  if(!Result->canReplace)
+    return false;
+
+  for(uint32_t i = LoopL->headerIdx, ilim = LoopL->headerIdx + LoopL->nBlocks; i != ilim; ++i) {
+
+    ShadowBB* BB = getBB(i);
+    if(!BB)
+      continue;
+
+    if((!pass->omitChecks) && pass->countPathConditionsAtBlockStart(BB->invar, this))
+      return false;
+
+    for(uint32_t j = 0, jlim = BB->invar->succIdxs.size(); j != jlim; ++j) {
+      if(edgeBranchesToUnspecialisedCode(BB->invar, getBBInvar(BB->invar->succIdxs[j])))
+	return false;
+    }
+
+    for(uint32_t j = 0, jlim = BB->insts.size(); j != jlim; ++j) {
+      if(requiresRuntimeCheck(ShadowValue(&BB->insts[j]), true))
+	return false;
+    }
+
+  }
+
+  for(std::vector<std::pair<ImprovedVal, Constant*> >::iterator it = Result->writes.begin(), 
+	itend = Result->writes.end(); it != itend; ++it) {
+
+    if(!canSynthPointer(0, it->first))
+      return false;
+
+  }
+
+  // The exit PHIs will be synthesised rather than emitted, since nothing is left to merge from.
+  if(ShadowBB* ExitBB = getBB(Result->exitTo)) {
+
+    for(uint32_t i = 0, ilim = ExitBB->insts.size(); i != ilim && inst_is<PHINode>(&ExitBB->insts[i]); ++i) {
+
+      ShadowInstruction* SI = &ExitBB->insts[i];
+      if(willBeDeleted(ShadowValue(SI)))
+	continue;
+
+      ShadowValue SV(SI);
+      ImprovedValSetSingle* IVS = dyn_cast_or_null<ImprovedValSetSingle>(SI->i.PB);
+      if((!IVS) || IVS->Values.size() != 1 || requiresRuntimeCheck(SV, false) || 
+	 !canSynthVal(&SV, IVS->SetType, IVS->Values[0]))
+	return false;
+
+    }
+
+  }
+
+  return true;
+
+}
+
+void IntegrationAttempt::releaseConcreteLoopResults() {
+
+  for(DenseMap<const ShadowLoopInvar*, ConcreteLoopResult*>::iterator it = concreteLoops.begin(),
+	itend = concreteLoops.end(); it != itend; ++it) {
+
+    delete it->second;
+
+  }
+
+  concreteLoops.clear();
+
+}
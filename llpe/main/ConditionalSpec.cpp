@@ -458,6 +458,7 @@ void IntegrationAttempt::applyMemoryPathConditionsFrom(ShadowBB* BB, PathConditi
 	release_assert((!SArg->i.PB) && "Path condition functions shouldn't be reentrant");
 
 	copyImprovedVal(Op, SArg->i.PB);
+	pass->noteValueChanged(ShadowValue(SArg));
 
       }
 
@@ -1301,7 +1302,7 @@ Value* IntegrationAttempt::getSpecValueAnyType(uint32_t blockIdx, uint32_t instI
     // and unspec incoming paths.
 
     ShadowInstruction* specI = getInst(blockIdx, instIdx);
-    if((!specI) || !specI->committedVal)
+    if((!specI) || !specI->getCommittedVal())
       return 0;
     else {
 
@@ -150,9 +150,6 @@ bool IntegrationAttempt::callCanExpand(ShadowInstruction* SI, InlineAttempt*& Re
 
   Result = 0;
   
-  if(pass->maxContexts != 0 && pass->IAs.size() > pass->maxContexts)
-    return false;
-
   Function* FCalled = getCalledFunction(SI);
   if(!FCalled) {
     LPDEBUG("Ignored " << itcache(SI) << " because it's an uncertain indirect call\n");
@@ -183,6 +180,11 @@ bool IntegrationAttempt::callCanExpand(ShadowInstruction* SI, InlineAttempt*& Re
     return false;
   }
 
+  if(!pass->budgetAllowsContext(FCalled, SI->parent->status & (BBSTATUS_CERTAIN | BBSTATUS_ASSUMED))) {
+    LPDEBUG("Ignored " << itcache(SI) << " because the analysis budget is running out\n");
+    return false;
+  }
+
   return true;
 
 }
@@ -235,7 +237,7 @@ InlineAttempt* IntegrationAttempt::getOrCreateInlineAttempt(ShadowInstruction* S
     }
     if(pass->verboseSharing)
       errs() << "SHARE: " << itcache(SI) << " #" << Share->SeqNumber << " (refs: " << Share->Callers.size() << ")\n";
-    SI->typeSpecificData = Share;
+    SI->setTypeSpecificData(Share);
     return Share;
   }
 
@@ -249,7 +251,7 @@ InlineAttempt* IntegrationAttempt::getOrCreateInlineAttempt(ShadowInstruction* S
       InlineAttempt* Unshared = Result->getWritableCopyFrom(SI);
       if(pass->verboseSharing)
 	errs() << "BREAK: " << itcache(SI) << " #" << Result->SeqNumber << " -> #" << Unshared->SeqNumber << "\n";
-      SI->typeSpecificData = Unshared;
+      SI->setTypeSpecificData(Unshared);
       created = true;
       return Unshared;
     }
@@ -269,7 +271,7 @@ InlineAttempt* IntegrationAttempt::getOrCreateInlineAttempt(ShadowInstruction* S
 
   InlineAttempt* IA = new InlineAttempt(pass, *FCalled, SI, this->nesting_depth + 1);
   IA->isModel = isModel;
-  SI->typeSpecificData = IA;
+  SI->setTypeSpecificData(IA);
 
   checkTargetStack(SI, IA);
 
@@ -416,9 +418,6 @@ PeelAttempt* IntegrationAttempt::getOrCreatePeelAttempt(const ShadowLoopInvar* N
   if(PeelAttempt* PA = getPeelAttempt(NewL))
     return PA;
 
-  if(pass->maxContexts != 0 && pass->IAs.size() > pass->maxContexts)
-    return 0;
- 
   // Preheaders only have one successor (the header), so this is enough.
   
   ShadowBB* preheaderBB = getBB(NewL->preheaderIdx);
@@ -429,6 +428,14 @@ PeelAttempt* IntegrationAttempt::getOrCreatePeelAttempt(const ShadowLoopInvar* N
 
   }
 
+  // Only a certain preheader counts as a certain path; assumed ones may be speculative.
+  if(!pass->budgetAllowsContext(getBBInvar(NewL->headerIdx)->BB, preheaderBB->isMarkedCertain())) {
+
+    LPDEBUG("Will not expand loop " << getBBInvar(NewL->headerIdx)->BB->getName() << " because the analysis budget is running out\n");
+    return 0;
+
+  }
+
   LPDEBUG("Inlining loop with header " << getBBInvar(NewL->headerIdx)->BB->getName() << "\n");
   PeelAttempt* LPA = new PeelAttempt(pass, this, F, NewL, nesting_depth + 1);
   peelChildren[NewL] = LPA;
@@ -236,6 +236,8 @@ bool IntegrationAttempt::shouldDIE(ShadowInstruction* I) {
       return true;
     if(isAllocationInstruction(ShadowValue(I)))
        return true;
+    if(isStringFunction(getCalledFunction(I)))
+      return true;
 
     return false;
 
@@ -65,7 +65,7 @@ std::string IntegrationAttempt::getValueColour(ShadowValue SV, std::string& text
   }
 
   if(val_is<CallInst>(SV) || val_is<InvokeInst>(SV)) {
-    if(SV.u.I->typeSpecificData)
+    if(SV.u.I->getTypeSpecificData())
       return "yellow";
     else
       return "pink";
@@ -396,13 +396,12 @@ static void setAllNeeded(DSEMapTy& M) {
 // Mark all stores affecting this stack frame needed.
 static void setAllNeeded(DSELocalStore::FrameType& frame) {
 
-  for(std::vector<DSEMapPointer>::iterator it = frame.store.begin(), itend = frame.store.end();
-      it != itend; ++it) {
+  for(uint32_t i = 0, ilim = frame.size(); i != ilim; ++i) {
 
-    if(it->isValid()) {
-      setAllNeeded(*it->M);
-      if(it->A)
-	it->A->isNeeded = true;
+    if(DSEMapPointer* slot = frame.getReadableSlot(i)) {
+      setAllNeeded(*slot->M);
+      if(slot->A)
+	slot->A->isNeeded = true;
     }
 
   }
@@ -416,7 +415,7 @@ static void setAllNeeded(DSELocalStore::NodeType* node, uint32_t height) {
 
     for(uint32_t i = 0, ilim = HEAPTREEORDER; i != ilim; ++i) {
 
-      DSEMapPointer* child = (DSEMapPointer*)node->children[i];
+      DSEMapPointer* child = (DSEMapPointer*)node->getChild(i);
 	
       if(child && child->isValid()) {
 	setAllNeeded(*child->M);
@@ -431,7 +430,7 @@ static void setAllNeeded(DSELocalStore::NodeType* node, uint32_t height) {
 
     for(uint32_t i = 0, ilim = HEAPTREEORDER; i != ilim; ++i) {
 
-      DSELocalStore::NodeType* child = (DSELocalStore::NodeType*)node->children[i];
+      DSELocalStore::NodeType* child = (DSELocalStore::NodeType*)node->getChild(i);
       if(child)
 	setAllNeeded(child, height - 1);
 
@@ -730,11 +729,15 @@ static bool containsUncertainPointers(ImprovedValSetSingle& IVS) {
 
 }
 
-// Merge DSE stores on entering BB, drawing a store from each predecessor block.
-void llvm::doDSEStoreMerge(ShadowBB* BB) {
+// Merge DSE stores on entering BB, drawing a store from each predecessor block
+// (incomingBlocks, if the caller has already found them).
+void llvm::doDSEStoreMerge(ShadowBB* BB, ArrayRef<ShadowBB*> incomingBlocks) {
 
   DSEMerger V(BB->IA, false);
-  BB->IA->visitNormalPredecessorsBW(BB, &V, /* ctx = */0);
+  if(incomingBlocks.empty())
+    BB->IA->visitNormalPredecessorsBW(BB, &V, /* ctx = */0);
+  else
+    V.setIncomingBlocks(incomingBlocks);
   V.doMerge();
 
   BB->dseStore = V.newMap;
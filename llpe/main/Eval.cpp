@@ -2326,6 +2326,8 @@ bool IntegrationAttempt::getNewResult(ShadowInstruction* SI, ImprovedValSet*& Ne
       bool Valid;
       if(tryEvaluateHeaderPHI(SI, Valid, NewResult))
 	return Valid;
+      if(tryEvaluateConcreteExitPHI(SI, NewResult))
+	return true;
       tryMerge = true;
       break;
     }
@@ -2443,6 +2445,30 @@ void IntegrationAttempt::noteIndirectUse(ShadowValue V, ImprovedValSet* NewPB) {
 
 }
 
+// Widening for the general loop analyser: a scalar value set that keeps growing is sent straight to
+// overdef after pass->loopWidenThreshold growth steps, rather than taking one more trip around the loop
+// for each new element. Pointer sets are left alone since making them overdef would require escaping
+// their targets.
+static void widenLoopValue(LLPEAnalysisPass* pass, ShadowValue V, ImprovedValSet* OldPB, ImprovedValSet* NewPB) {
+
+  ImprovedValSetSingle* OldIVS = dyn_cast<ImprovedValSetSingle>(OldPB);
+  ImprovedValSetSingle* NewIVS = dyn_cast<ImprovedValSetSingle>(NewPB);
+  if((!OldIVS) || (!NewIVS) || OldIVS->Overdef || NewIVS->Overdef)
+    return;
+
+  if(OldIVS->SetType != ValSetTypeScalar || NewIVS->SetType != ValSetTypeScalar)
+    return;
+
+  if(NewIVS->Values.size() <= OldIVS->Values.size())
+    return;
+
+  if(++pass->loopGrowthSteps[V] >= pass->loopWidenThreshold) {
+    NewIVS->setOverdef();
+    ++pass->stats.loopValuesWidened;
+  }
+
+}
+
 // Main entry point for this file: (re-)evaluate general instruction or argument V. 
 // If we're analysing an unbounded loop (inLoopAnalyser) we can short-cut this process when analysing 
 // V for the second time, because values only get less informative on repeated analysis.
@@ -2486,6 +2512,9 @@ bool IntegrationAttempt::tryEvaluate(ShadowValue V, bool inLoopAnalyser, bool& l
 
   }
 
+  if(inLoopAnalyser && OldPBValid && pass->loopWidenThreshold)
+    widenLoopValue(pass, V, OldPB, NewPB);
+
   if((!OldPBValid) || !IVsEqualShallow(OldPB, NewPB)) {
 
     if(pass->verboseOverdef) {
@@ -2512,6 +2541,8 @@ bool IntegrationAttempt::tryEvaluate(ShadowValue V, bool inLoopAnalyser, bool& l
       SA->i.PB = NewPB;
     }
 
+    pass->noteValueChanged(V);
+
     bool verbose = false;
 
     if(verbose) {
@@ -0,0 +1,363 @@
+//===-- HeapReclaim.cpp ---------------------------------------------------===//
+//
+//                                  LLPE
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.txt for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Analysis/LLPE.h"
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+
+#define DEBUG_TYPE "llpe-misc"
+
+using namespace llvm;
+
+// Reclaiming heap slots. Every allocation executed during specialisation gets a slot in pass->heap,
+// and its index is the key used by the heap trees of every store, so when a program allocates in
+// loops or in many calls the index space, and so the trees' height and sparsity, keeps growing.
+//
+// Every -llpe-heap-reclaim-interval committed calls we find slots that nothing can refer to any more:
+// no live instruction, argument or return value, no value in any live store, and no sharing record
+// mentions a pointer to them, and no pointer to them has ever escaped (AllocData::everEscaped), since
+// an escaped pointer may be sitting in memory we don't model. Dropping a DSE entry releases its
+// stores as unread, so it is only safe once we know the object can never be read again.
+// Their entries are dropped from every store (ordinary, DSE and TL),
+// their indices are handed out again by addHeapAlloc, and any free slots at the end of the heap are
+// trimmed away. We only run right after a call has been committed outside the loop analyser, when no
+// store merges or loop sessions are in flight and every store in existence is on its map kind's
+// liveMaps list.
+//
+// Slots that predate specialisation (globals, argv, special locations) and slots with outstanding
+// PatchRefs are never reclaimed.
+
+static cl::opt<unsigned> HeapReclaimInterval("llpe-heap-reclaim-interval", cl::init(0));
+
+struct HeapMarker {
+
+  BitVector& live;
+  SmallPtrSet<void*, 64> visited;
+
+  HeapMarker(BitVector& L) : live(L) { }
+
+  void markValue(const ShadowValue& V) {
+
+    if(!V.isPtrIdx() || V.getFrameNo() != -1)
+      return;
+
+    int32_t idx = V.getHeapKey();
+    if(idx >= 0 && (uint32_t)idx < live.size())
+      live.set(idx);
+
+  }
+
+  void markIVS(ImprovedValSet* IVS) {
+
+    if(!IVS)
+      return;
+
+    if(ImprovedValSetSingle* IVSS = dyn_cast<ImprovedValSetSingle>(IVS)) {
+
+      for(uint32_t i = 0, ilim = IVSS->Values.size(); i != ilim; ++i)
+	markValue(IVSS->Values[i].V);
+
+    }
+    else {
+
+      if(!visited.insert(IVS).second)
+	return;
+
+      ImprovedValSetMulti* IVM = cast<ImprovedValSetMulti>(IVS);
+      for(ImprovedValSetMulti::MapIt it = IVM->Map.begin(), itend = IVM->Map.end(); it != itend; ++it) {
+	for(uint32_t i = 0, ilim = it.val().Values.size(); i != ilim; ++i)
+	  markValue(it.val().Values[i].V);
+      }
+
+      markIVS(IVM->Underlying);
+
+    }
+
+  }
+
+  void markNode(SharedTreeNode<LocStore, OrdinaryStoreExtraState>* node, uint32_t height) {
+
+    if(!visited.insert(node).second)
+      return;
+
+    for(uint32_t i = 0; i < HEAPTREEORDER; ++i) {
+
+      void* child = node->getChild(i);
+      if(!child)
+	continue;
+
+      if(height == 0)
+	markIVS(((LocStore*)child)->store);
+      else
+	markNode((SharedTreeNode<LocStore, OrdinaryStoreExtraState>*)child, height - 1);
+
+    }
+
+  }
+
+  // Conservatively, everything a store's objects point to is live, whether or not the pointing object is.
+  void markStore(OrdinaryLocalStore* Map) {
+
+    for(uint32_t i = 0, ilim = Map->frames.size(); i != ilim; ++i) {
+
+      OrdinaryLocalStore::FrameType* Frame = Map->frames[i];
+      if(!visited.insert(Frame).second)
+	continue;
+
+      for(uint32_t j = 0, jlim = Frame->size(); j != jlim; ++j) {
+	if(LocStore* LS = Frame->getReadableSlot(j))
+	  markIVS(LS->store);
+      }
+
+    }
+
+    if(Map->heap.height)
+      markNode(Map->heap.root, Map->heap.height - 1);
+
+  }
+
+  void markContext(IntegrationAttempt* IA) {
+
+    if(!visited.insert(IA).second)
+      return;
+
+    // Committed and released: nothing left to mark.
+    if(!IA->BBs)
+      return;
+
+    for(uint32_t i = 0, ilim = IA->nBBs; i != ilim; ++i) {
+
+      ShadowBB* BB = IA->BBs[i];
+      if(!BB)
+	continue;
+
+      for(uint32_t j = 0, jlim = BB->insts.size(); j != jlim; ++j)
+	markIVS(BB->insts[j].i.PB);
+
+    }
+
+    for(IAIterator it = child_calls_begin(IA), itend = child_calls_end(IA); it != itend; ++it)
+      markInlineAttempt(it->second);
+
+    for(DenseMap<const ShadowLoopInvar*, PeelAttempt*>::iterator it = IA->peelChildren.begin(),
+	  itend = IA->peelChildren.end(); it != itend; ++it) {
+
+      for(uint32_t i = 0, ilim = it->second->Iterations.size(); i != ilim; ++i)
+	markContext(it->second->Iterations[i]);
+
+    }
+
+    // Loops run concretely keep pointers for their exit PHIs and writes until commit.
+    for(DenseMap<const ShadowLoopInvar*, ConcreteLoopResult*>::iterator it = IA->concreteLoops.begin(),
+	  itend = IA->concreteLoops.end(); it != itend; ++it) {
+
+      ConcreteLoopResult* Result = it->second;
+
+      for(uint32_t i = 0, ilim = Result->exitPHIValues.size(); i != ilim; ++i)
+	markIVS(&Result->exitPHIValues[i].second);
+
+      for(uint32_t i = 0, ilim = Result->writes.size(); i != ilim; ++i)
+	markValue(Result->writes[i].first.V);
+
+    }
+
+  }
+
+  // Arguments, return value and sharing records outlive the context's blocks.
+  void markInlineAttempt(InlineAttempt* IA) {
+
+    if(visited.count(IA))
+      return;
+
+    for(uint32_t i = 0, ilim = IA->argShadows.size(); i != ilim; ++i)
+      markIVS(IA->argShadows[i].i.PB);
+
+    markIVS(IA->returnValue);
+
+    if(IA->sharing) {
+
+      for(DenseMap<ShadowValue, ImprovedValSet*>::iterator it = IA->sharing->externalDependencies.begin(),
+	    itend = IA->sharing->externalDependencies.end(); it != itend; ++it) {
+
+	markValue(it->first);
+	markIVS(it->second);
+
+      }
+
+    }
+
+    markContext(IA);
+
+  }
+
+};
+
+void OrdinaryStoreExtraState::dropDeadObjects(const BitVector& dead) {
+
+  DenseSet<ShadowValue>* Sets[3] = { &threadLocalObjects, &noAliasOldObjects, &unescapedObjects };
+
+  for(uint32_t i = 0; i != 3; ++i) {
+
+    SmallVector<ShadowValue, 4> toErase;
+    for(DenseSet<ShadowValue>::iterator it = Sets[i]->begin(), itend = Sets[i]->end(); it != itend; ++it) {
+
+      if(it->isPtrIdx() && it->getFrameNo() == -1) {
+	uint32_t idx = (uint32_t)it->getHeapKey();
+	if(idx < dead.size() && dead[idx])
+	  toErase.push_back(*it);
+      }
+
+    }
+
+    for(uint32_t j = 0, jlim = toErase.size(); j != jlim; ++j)
+      Sets[i]->erase(toErase[j]);
+
+  }
+
+}
+
+template<class MapType> static void dropDeadSlotsFromAll(const BitVector& dead) {
+
+  for(MapType* Map = MapType::liveMaps; Map; Map = Map->nextLive)
+    Map->dropDeadSlots(dead);
+
+}
+
+// Called each time a call has been finalised and committed outside the loop analyser.
+void LLPEAnalysisPass::noteCallCommitted() {
+
+  if(!HeapReclaimInterval)
+    return;
+
+  if(++callsSinceHeapReclaim < HeapReclaimInterval)
+    return;
+
+  callsSinceHeapReclaim = 0;
+  reclaimHeapSlots();
+
+}
+
+void LLPEAnalysisPass::reclaimHeapSlots() {
+
+  uint32_t heapSize = heap.size();
+  if(heapSize <= heapReclaimFloor)
+    return;
+
+  ++stats.heapReclaimRuns;
+
+  BitVector live(heapSize);
+
+  // Mark phase:
+  {
+
+    HeapMarker Marker(live);
+
+    for(OrdinaryLocalStore* Map = OrdinaryLocalStore::liveMaps; Map; Map = Map->nextLive)
+      Marker.markStore(Map);
+
+    Marker.markInlineAttempt(RootIA);
+
+    for(DenseMap<Function*, std::vector<InlineAttempt*> >::iterator it = IAsByFunction.begin(),
+	  itend = IAsByFunction.end(); it != itend; ++it) {
+
+      for(uint32_t i = 0, ilim = it->second.size(); i != ilim; ++i)
+	Marker.markInlineAttempt(it->second[i]);
+
+    }
+
+    for(uint32_t i = 0, ilim = targetCallStackIAs.size(); i != ilim; ++i)
+      Marker.markInlineAttempt(targetCallStackIAs[i]);
+
+    for(DenseMap<ShadowInstruction*, SmallVector<IVSRange, 4> >::iterator it = memcpyValues.begin(),
+	  itend = memcpyValues.end(); it != itend; ++it) {
+
+      for(uint32_t i = 0, ilim = it->second.size(); i != ilim; ++i)
+	Marker.markIVS(&it->second[i].second);
+
+    }
+
+    for(DenseMap<ShadowValue, std::vector<std::pair<ShadowValue, uint32_t> > >::iterator it = indirectDIEUsers.begin(),
+	  itend = indirectDIEUsers.end(); it != itend; ++it) {
+
+      Marker.markValue(it->first);
+      for(uint32_t i = 0, ilim = it->second.size(); i != ilim; ++i)
+	Marker.markValue(it->second[i].first);
+
+    }
+
+  }
+
+  BitVector isFree(heapSize);
+  for(uint32_t i = 0, ilim = freeHeapSlots.size(); i != ilim; ++i)
+    isFree.set(freeHeapSlots[i]);
+
+  // Sweep phase: slots newly found dead.
+  BitVector dead(heapSize);
+  uint32_t nDead = 0;
+
+  for(uint32_t i = heapReclaimFloor; i != heapSize; ++i) {
+
+    if(live[i] || isFree[i] || heap[i].everEscaped || !heap[i].PatchRefs.empty())
+      continue;
+
+    dead.set(i);
+    ++nDead;
+
+  }
+
+  if(nDead) {
+
+    dropDeadSlotsFromAll<OrdinaryLocalStore>(dead);
+    dropDeadSlotsFromAll<DSELocalStore>(dead);
+    dropDeadSlotsFromAll<TLLocalStore>(dead);
+
+    // The committed allocation no longer needs protecting from DIE, but any uses already emitted
+    // from other functions must still be forwarded by fixNonLocalUses.
+    SmallVector<Value*, 4> toErase;
+    for(DenseMap<Value*, uint32_t>::iterator it = committedHeapAllocations.begin(),
+	  itend = committedHeapAllocations.end(); it != itend; ++it) {
+
+      if(it->second < heapSize && dead[it->second])
+	toErase.push_back(it->first);
+
+    }
+
+    for(uint32_t i = 0, ilim = toErase.size(); i != ilim; ++i) {
+      committedHeapAllocations.erase(toErase[i]);
+      reclaimedHeapAllocations.push_back(WeakVH(toErase[i]));
+    }
+
+    for(int i = dead.find_first(); i != -1; i = dead.find_next(i)) {
+      heap[i] = AllocData();
+      heap[i].allocIdx = i;
+      isFree.set(i);
+    }
+
+    stats.heapSlotsReclaimed += nDead;
+
+  }
+
+  // Compact: trim free slots off the end of the heap, then hand out the rest lowest-first.
+  uint32_t newSize = heapSize;
+  while(newSize > heapReclaimFloor && isFree[newSize - 1])
+    --newSize;
+
+  stats.heapSlotsTrimmed += (heapSize - newSize);
+  heap.resize(newSize);
+
+  freeHeapSlots.clear();
+  for(uint32_t i = newSize; i != heapReclaimFloor; --i) {
+    if(isFree[i - 1])
+      freeHeapSlots.push_back(i - 1);
+  }
+
+  LLVM_DEBUG(dbgs() << "Heap reclamation: " << nDead << " slots reclaimed, heap " << heapSize << " -> " << newSize << ", " << freeHeapSlots.size() << " free\n");
+
+}
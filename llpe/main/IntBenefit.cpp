@@ -15,6 +15,10 @@
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/Process.h"
+
+#include <stdio.h>
+#include <unistd.h>
 
 using namespace llvm;
 
@@ -199,6 +203,8 @@ void PeelAttempt::findProfitableIntegration() {
     totalIntegrationGoodness += Iterations[i]->totalIntegrationGoodness;
   }
 
+  pass->noteContextBenefit(parent->getBBInvar(L->headerIdx)->BB, totalIntegrationGoodness);
+
   if(totalIntegrationGoodness < 0) {
 
     // Overall, not profitable to peel this loop.
@@ -315,6 +321,8 @@ void InlineAttempt::findProfitableIntegration() {
 
   IntegrationAttempt::findProfitableIntegration();
 
+  pass->noteContextBenefit(&F, totalIntegrationGoodness);
+
   if(totalIntegrationGoodness < 0)
     setEnabled(false, true);
 
@@ -465,3 +473,92 @@ void IntegrationAttempt::collectStats() {
     it->second->collectStats();
 
 }
+
+// Our resident set size. Unlike mallinfo-based GetMallocUsage this doesn't wrap at 2GB and
+// includes large mmapped allocations, which is what the memory budget is really about.
+uint64_t llvm::getResidentBytes() {
+
+  FILE* statm = fopen("/proc/self/statm", "r");
+  if(!statm)
+    return sys::Process::GetMallocUsage();
+
+  unsigned long long totalPages, residentPages;
+  int matched = fscanf(statm, "%llu %llu", &totalPages, &residentPages);
+  fclose(statm);
+
+  if(matched != 2)
+    return sys::Process::GetMallocUsage();
+
+  return ((uint64_t)residentPages) * sysconf(_SC_PAGESIZE);
+
+}
+
+// Analysis budget: return the fraction of the most-used budget dimension consumed so far.
+double LLPEAnalysisPass::budgetPressure() {
+
+  double pressure = 0;
+
+  if(maxContexts)
+    pressure = std::max(pressure, ((double)IAs.size()) / maxContexts);
+
+  if(timeBudget != 0) {
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - analysisStart;
+    pressure = std::max(pressure, elapsed.count() / timeBudget);
+  }
+
+  if(memoryBudget)
+    pressure = std::max(pressure, ((double)getResidentBytes()) / memoryBudget);
+
+  return pressure;
+
+}
+
+// Record the integration goodness of a finished function or loop context, keyed by its Function or loop header.
+void LLPEAnalysisPass::noteContextBenefit(const Value* Key, int64_t goodness) {
+
+  std::pair<int64_t, uint32_t>& History = benefitHistory[Key];
+  History.first += goodness;
+  ++History.second;
+
+}
+
+// Should we create a new context for the function or loop header Key? Until half the budget is used,
+// always; after that stop exploring things whose earlier instances turned out not to be worth specialising,
+// and past 80% only explore those with a profitable track record on certain paths. Once the budget
+// is exhausted, stop creating contexts altogether.
+bool LLPEAnalysisPass::budgetAllowsContext(const Value* Key, bool certainPath) {
+
+  double pressure = budgetPressure();
+  if(pressure < 0.5)
+    return true;
+
+  bool allow;
+
+  if(pressure > 1.0) {
+
+    if(!budgetExhaustedNoted) {
+      errs() << "\nAnalysis budget exhausted: no further contexts will be created\n";
+      budgetExhaustedNoted = true;
+      writeMemoryReport("budget-exhausted");
+    }
+    allow = false;
+
+  }
+  else {
+
+    DenseMap<const Value*, std::pair<int64_t, uint32_t> >::iterator findit = benefitHistory.find(Key);
+    bool knownGood = findit != benefitHistory.end() && findit->second.first > 0;
+    bool knownBad = findit != benefitHistory.end() && findit->second.first <= 0;
+
+    if(pressure < 0.8)
+      allow = !knownBad;
+    else
+      allow = knownGood && certainPath;
+
+  }
+
+  if(!allow)
+    ++stats.budgetRefusedContexts;
+  return allow;
+
+}
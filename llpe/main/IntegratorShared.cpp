@@ -332,7 +332,10 @@ Function* llvm::getCalledFunction(ShadowInstruction* SI) {
 
 bool ImprovedValSetSingle::dropReference() {
 
-  // Singles can never be shared
+  // Singles are never refcounted; the pass' shared overdef sets are simply never freed.
+  if(isSharedIVS(this))
+    return true;
+
   LFV3(errs() << "Drop ref on single val: deleted\n");
   delete this;
 
@@ -9,11 +9,10 @@
 
 #include "llvm/Analysis/LLPE.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
 
 #include <openssl/sha.h>
 #include <sys/stat.h>
-#include <fcntl.h>
-#include <unistd.h>
 
 #define DEBUG_TYPE "llpe-misc"
 
@@ -22,57 +21,29 @@ using namespace llvm;
 // Functions to write a summary of the files consumed in this specialisation,
 // for consumption by the LLIO watch daemon (lliowd).
 
-// Compute SHA-1 hash of Filename:
+// Compute SHA-1 hash of Filename, as it was when specialisation first looked at it:
 
-static bool getFileSha1(std::string& Filename, unsigned char* hash) {
+bool llvm::getFileSha1(const std::string& Filename, unsigned char* hash) {
 
-  SHA_CTX hashctx;
-  if(!SHA1_Init(&hashctx)) {
-
-    errs() << "SHA1_Init\n";
-    return false;
+  std::string errors;
+  const MemoryBuffer* MB = getFileSnapshot(Filename, errors);
+  if(!MB) {
 
-  }
-	
-  int filefd = open(Filename.c_str(), O_RDONLY);
-  if(filefd == -1) {
-	  
-    errs() << "Cannot open " << Filename << "\n";
+    errs() << errors << "\n";
     return false;
 
   }
-	
-  char readbuf[4096];
-  int thisread;
-
-  while((thisread = read(filefd, readbuf, 4096)) > 0) {
-
-    if(!SHA1_Update(&hashctx, readbuf, thisread)) {
-
-      errs() << "SHA1_Update\n";
-      return false;
-
-    }
-
-  }
 
-  if(thisread == -1) {
+  SHA_CTX hashctx;
+  if((!SHA1_Init(&hashctx)) ||
+     (!SHA1_Update(&hashctx, MB->getBufferStart(), MB->getBufferSize())) ||
+     (!SHA1_Final(hash, &hashctx))) {
 
-    errs() << "Read failed for " << Filename << "\n";
-    close(filefd);
+    errs() << "SHA-1 failed for " << Filename << "\n";
     return false;
 
   }
 
-  if(!SHA1_Final(hash, &hashctx)) {
-
-    errs() << "SHA1_Final\n";
-    close(filefd);
-    return false;;
-
-  }
-
-  close(filefd);
   return true;
 
 }
@@ -82,7 +53,7 @@ static bool getFileSha1(std::string& Filename, unsigned char* hash) {
 static time_t getFileMtime(std::string& filename) {
 
   struct stat st;
-  int ret = ::stat(filename.c_str(), &st);
+  int ret = statCachedFile(filename, &st);
   if(ret == -1) {
 
     errs() << "Failed to stat " << filename << "\n";
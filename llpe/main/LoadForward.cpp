@@ -47,7 +47,7 @@ static void checkIVSNull(ImprovedValSetSingle& IVS) {
 // An ImprovedValSetMulti represents a composite improved value -- for example,
 // { i32 flags, i32 fd }, which cannot be represented as a constant since the fd
 // is a symbolic object whilst the flags are a simple constant.
-// We use an IntervalMap (named Map) to describe how component IVSes are laid out.
+// We use an extent map (named Map; see IVSExtentMap) to describe how component IVSes are laid out.
 // They might describe a whole object, or if Underlying is set describe an overlay
 // atop that map.
 ImprovedValSetMulti::ImprovedValSetMulti(uint64_t ASize) : ImprovedValSet(true), Map(GlobalIHP->IMapAllocator), MapRefCount(1), Underlying(0), CoveredBytes(0), AllocSize(ASize) { }
@@ -57,11 +57,7 @@ ImprovedValSetMulti::ImprovedValSetMulti(const ImprovedValSetMulti& other) : Imp
   if(Underlying)
     Underlying = Underlying->getReadableCopy();
 
-  for(ImprovedValSetMulti::ConstMapIt it = other.Map.begin(), itend = other.Map.end(); it != itend; ++it) {
-
-    Map.insert(it.start(), it.stop(), *it);
-
-  }
+  Map.copyFrom(other.Map);
 
 }
 
@@ -199,7 +195,8 @@ static bool shouldMultiload(ImprovedValSetSingle& PB) {
 }
 
 // Try to execute load LI which reads from a set of 2+ pointers.
-static bool tryMultiload(ShadowInstruction* LI, ImprovedValSet*& NewIV, std::string* report) {
+// Set notedDependency if the result depends on a store and so our context's sharing must be made contingent on it.
+static bool tryMultiload(ShadowInstruction* LI, ImprovedValSet*& NewIV, std::string* report, bool* notedDependency = 0) {
 
   uint64_t LoadSize = GlobalTD->getTypeStoreSize(LI->getType());
 
@@ -241,6 +238,8 @@ static bool tryMultiload(ShadowInstruction* LI, ImprovedValSet*& NewIV, std::str
     if(ThisMulti || !ThisPB.isWhollyUnknown()) {
 
       LI->parent->IA->noteDependency(LIPB.Values[i].V);
+      if(notedDependency)
+	*notedDependency = true;
 
     }
 
@@ -287,6 +286,26 @@ static bool tryMultiload(ShadowInstruction* LI, ImprovedValSet*& NewIV, std::str
 
 }
 
+// During a loop analysis session with -llpe-load-forward-cache, a load from a single object remembers
+// the version of the object's store it read. Get that store if LI can use the cache.
+static LocStore* getCacheableLoadStore(ShadowInstruction* LI, const ImprovedValSetSingle& LoadPtrPB) {
+
+  if(!GlobalIHP->inLoadCacheSession() || LoadPtrPB.Values.size() != 1)
+    return 0;
+
+  // Nulls, undefs and constant globals aren't read through the store.
+  const ShadowValue& V = LoadPtrPB.Values[0].V;
+  if(V.isVal())
+    return 0;
+  if(ShadowGV* G = V.getGV()) {
+    if(G->G->isConstant())
+      return 0;
+  }
+
+  return LI->parent->getReadableStoreFor(V);
+
+}
+
 // Fish a value out of the block-local or value store for LI.
 bool IntegrationAttempt::tryForwardLoadPB(ShadowInstruction* LI, ImprovedValSet*& NewPB, bool& loadedVararg) {
 
@@ -302,7 +321,55 @@ bool IntegrationAttempt::tryForwardLoadPB(ShadowInstruction* LI, ImprovedValSet*
   getImprovedValSetSingle(LI->getOperand(0), LoadPtrPB);
   if(shouldMultiload(LoadPtrPB)) {
 
-    ret = tryMultiload(LI, NewPB, error.get());
+    LocStore* CacheStore = error.get() ? 0 : getCacheableLoadStore(LI, LoadPtrPB);
+
+    if(CacheStore) {
+
+      DenseMap<ShadowInstruction*, LoadForwardCacheEntry>::iterator findit = pass->loadForwardCache.find(LI);
+      if(findit != pass->loadForwardCache.end()) {
+
+	LoadForwardCacheEntry& Entry = findit->second;
+	if(Entry.ptr == LoadPtrPB.Values[0] && Entry.version == CacheStore->version && Entry.loadType == LI->getType()) {
+
+	  // Replay tryMultiload's side-effects:
+	  ShadowValue& Obj = LoadPtrPB.Values[0].V;
+	  if(LI->parent->localStore->es.threadLocalObjects.count(Obj))
+	    LI->isThreadLocal = TLS_NEVERCHECK;
+	  else
+	    LI->isThreadLocal = TLS_MUSTCHECK;
+	  if(Entry.notedDependency)
+	    noteDependency(Obj);
+
+	  ++pass->stats.loadForwardCacheHits;
+	  NewPB = copyIV(Entry.result);
+	  if(ImprovedValSetSingle* NewIVS = dyn_cast<ImprovedValSetSingle>(NewPB)) {
+	    if(NewIVS->SetType == ValSetTypeVarArg)
+	      loadedVararg = true;
+	  }
+	  return IVIsInitialised(NewPB);
+
+	}
+
+      }
+
+    }
+
+    bool notedDependency = false;
+    ret = tryMultiload(LI, NewPB, error.get(), &notedDependency);
+
+    if(CacheStore) {
+
+      ++pass->stats.loadForwardCacheMisses;
+      LoadForwardCacheEntry& Entry = pass->loadForwardCache[LI];
+      if(Entry.result)
+	deleteIV(Entry.result);
+      Entry.ptr = LoadPtrPB.Values[0];
+      Entry.version = CacheStore->version;
+      Entry.loadType = LI->getType();
+      Entry.notedDependency = notedDependency;
+      Entry.result = copyIV(NewPB);
+
+    }
     if(ImprovedValSetSingle* NewIVS = dyn_cast<ImprovedValSetSingle>(NewPB)) {
 
       if(NewIVS->SetType == ValSetTypeVarArg)
@@ -458,7 +525,10 @@ LocStore* ShadowBB::getReadableStoreFor(const ShadowValue& V) {
 LocStore* ShadowBB::getOrCreateStoreFor(ShadowValue& V, bool* isNewStore) {
 
   localStore = localStore->getWritableFrameList();
-  return localStore->getOrCreateStoreFor(V, isNewStore);
+  LocStore* ret = localStore->getOrCreateStoreFor(V, isNewStore);
+  // Our caller is about to write it.
+  ret->noteWrite();
+  return ret;
 
 }
 
@@ -2403,6 +2473,19 @@ void llvm::executeAllocaInst(ShadowInstruction* SI) {
 
 AllocData& llvm::addHeapAlloc(ShadowInstruction* SI) {
 
+  // Prefer a slot freed by reclaimHeapSlots, keeping heap indices (and so heap tree heights) low.
+  if(!GlobalIHP->freeHeapSlots.empty()) {
+
+    uint32_t allocIdx = GlobalIHP->freeHeapSlots.back();
+    GlobalIHP->freeHeapSlots.pop_back();
+    AllocData& AD = GlobalIHP->heap[allocIdx];
+    AD = AllocData();
+    AD.allocIdx = allocIdx;
+    ++GlobalIHP->stats.heapSlotsRecycled;
+    return AD;
+
+  }
+
   uint32_t allocIdx = GlobalIHP->heap.size();
   GlobalIHP->heap.push_back(AllocData());
   GlobalIHP->heap.back().allocIdx = allocIdx;
@@ -2429,7 +2512,7 @@ static void executeMallocInst2(ShadowInstruction* SI, AllocatorFn& param) {
   SI->parent->IA->noteMalloc(SI);
 
   AllocData& AD = addHeapAlloc(SI);
-  executeAllocInst(SI, AD, allocType, AllocSize ? AllocSize->getLimitedValue() : ULONG_MAX, -1, GlobalIHP->heap.size() - 1);
+  executeAllocInst(SI, AD, allocType, AllocSize ? AllocSize->getLimitedValue() : ULONG_MAX, -1, AD.allocIdx);
   
 }
 
@@ -2480,7 +2563,7 @@ void llvm::executeReallocInst(ShadowInstruction* SI, Function* F) {
     SI->parent->IA->noteMalloc(SI);
 
     AllocData& AD = addHeapAlloc(SI);
-    executeAllocInst(SI, AD, allocType, AllocSize ? AllocSize->getLimitedValue() : ULONG_MAX, -1, GlobalIHP->heap.size() - 1);
+    executeAllocInst(SI, AD, allocType, AllocSize ? AllocSize->getLimitedValue() : ULONG_MAX, -1, AD.allocIdx);
 
   }
   else {
@@ -2718,14 +2801,10 @@ void llvm::executeReadInst(ShadowInstruction* ReadSI, std::string& Filename, uin
   }
   else {
 
-    std::vector<Constant*> constBytes;
     std::string errors;
     LLVMContext& Context = Ptr.getLLVMContext();
-    if(getFileBytes(Filename, FileOffset, Size, constBytes, Context,  errors)) {
-      ArrayType* ArrType = ArrayType::get(IntegerType::get(Context, 8), constBytes.size());
-      Constant* ByteArray = ConstantArray::get(ArrType, constBytes);
+    if(Constant* ByteArray = getFileBytes(Filename, FileOffset, Size, Context, errors))
       WriteIVS = ImprovedValSetSingle(ImprovedVal(ByteArray, 0), ValSetTypeScalar);
-    }
 
   }
 
@@ -2750,6 +2829,8 @@ void llvm::initSpecialFunctionsMap(Module& M) {
   if(Function* F6 = M.getFunction("integrator_same_object"))
     SpecialFunctionMap[F6] = SF_SAMEOBJECT;
 
+  initStringFunctionsMap(M);
+
 }
 
 // Can Ptr alias objects that existed before the specialisation root was entered?
@@ -3325,6 +3406,13 @@ void ShadowBB::clobberGlobalObjects() {
 // but the initial allocation site?
 static void pointerEscaped(const ShadowValue V, ShadowBB* BB) {
 
+  // Remember this across all contexts and merges: reclaimHeapSlots can't see where the pointer went.
+  if(V.isPtrIdx() && V.getFrameNo() == -1) {
+    int32_t idx = V.getHeapKey();
+    if(idx >= 0 && (uint32_t)idx < GlobalIHP->heap.size())
+      GlobalIHP->heap[idx].everEscaped = true;
+  }
+
   if(BB->localStore->es.unescapedObjects.count(V)) {
 
     BB->localStore = BB->localStore->getWritableFrameList();
@@ -3640,10 +3728,7 @@ static void scalarSplatToScalar(ImprovedValSetSingle& IVS, Type* targetType) {
     uint64_t Size = GlobalTD->getTypeStoreSize(targetType);
     PartialVal PV(Size);
     uint8_t SplatVal = (uint8_t)cast<ConstantInt>(IVS.Values[i].V.getVal())->getLimitedValue();
-    memset(PV.partialBuf, SplatVal, Size);
-    for(uint64_t i = 0; i != Size; ++i)
-      PV.partialValidBuf[i] = true;
-    PV.loadFinished = true;
+    PV.combineWithSplat(SplatVal, 0, Size);
     Constant* PVC = PVToConst(PV, Size, targetType->getContext());
     IVS.Values[i] = ImprovedVal(ShadowValue(PVC));
 
@@ -3738,6 +3823,8 @@ void LocStore::mergeStores(LocStore* mergeFromStore, LocStore* mergeToStore, uin
   if(mergeFromStore->store == mergeToStore->store)
     return;
 
+  mergeToStore->noteWrite();
+
   if(ImprovedValSetSingle* IVS = dyn_cast<ImprovedValSetSingle>(mergeToStore->store)) {
 
     LFV3(errs() << "Merge in store " << mergeFromStore << " -> " << mergeToStore << "\n");
@@ -4157,7 +4244,7 @@ void OrdinaryStoreExtraState::doMerge(OrdinaryLocalStore* toMap,
 // fixed point analyser -- e.g. this block only becomes reachable on iteration 2.
 // TODO: invariants like that have been removed, so could probably drop the return value
 // and tests on same.
-bool llvm::doBlockStoreMerge(ShadowBB* BB) {
+bool llvm::doBlockStoreMerge(ShadowBB* BB, SmallVectorImpl<ShadowBB*>* incomingBlocks) {
 
   // We're entering BB; one or more live predecessor blocks exist and we must produce an appropriate
   // localStore from them.
@@ -4189,6 +4276,10 @@ bool llvm::doBlockStoreMerge(ShadowBB* BB) {
 
   BB->localStore = V.newMap;
 
+  // The DSE and TL merges draw from the same blocks; save them walking predecessors again.
+  if(incomingBlocks)
+    incomingBlocks->append(V.incomingBlocks.begin(), V.incomingBlocks.end());
+
   doBlockFDStoreMerge(BB);
 
   return true;
@@ -4293,5 +4384,6 @@ ShadowInstruction* IntegrationAttempt::getAllocInst(ShadowValue V) {
 
 }
 
+uint64_t LocStore::nextVersion = 0;
 static ImprovedValSetSingle NormalEmptyMap(ValSetTypeDeallocated, false);
 LocStore llvm::NormalEmptyMapPtr(&NormalEmptyMap);
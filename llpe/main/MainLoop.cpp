@@ -62,6 +62,7 @@ bool InlineAttempt::analyseWithArgs(ShadowInstruction* SI, bool inLoopAnalyser,
 
     anyChange = true;
     copyImprovedVal(Op, SArg->i.PB);
+    pass->noteValueChanged(ShadowValue(SArg));
 
   }
 
@@ -161,6 +162,8 @@ void InlineAttempt::getInitialStore(bool inLoopAnalyser) {
   else {
     BBs[0]->localStore = new OrdinaryLocalStore(0);
     initialiseStore(BBs[0]);
+    // Everything allocated so far (globals, argv, special locations) lives for the whole run.
+    pass->heapReclaimFloor = std::max(pass->heapReclaimFloor, (uint32_t)pass->heap.size());
     BBs[0]->fdStore = new FDStore();
     initialiseFDStore(BBs[0]->fdStore);
     BBs[0]->tlStore = new TLLocalStore(0);
@@ -263,23 +266,69 @@ bool PeelAttempt::analyse(uint32_t parent_stack_depth, bool& readsTentativeData,
 
   readsTentativeData = false;
 
-  for(PeelIteration* PI = Iterations[0]; PI; PI = PI->getOrCreateNextIteration()) {
+  uint32_t iter = 0;
+  for(PeelIteration* PI = Iterations[0]; PI; PI = PI->getOrCreateNextIteration(), ++iter) {
 
     anyChange |= PI->analyse(false, true, parent_stack_depth);
     parent->inheritDiagnosticsFrom(PI);
     readsTentativeData |= PI->readsTentativeData;
     containsCheckedReads |= PI->containsCheckedReads;
 
+    // The previous iteration's latch store has now been consumed by this one.
+    if(iter != 0)
+      Iterations[iter - 1]->compactValues();
+
   }
 
   Iterations.back()->checkFinalIteration();
   if(!isTerminated())
     dropNonterminatedStoreRefs();
+
+  // The last iteration is finished too, whether or not it exits.
+  Iterations.back()->compactValues();
  
   return anyChange;
 
 }
 
+// Called once the next iteration has been analysed. Commit, DIE and DSE still walk this iteration's
+// blocks and instructions, so those must stay; but typically most of its results are plain unknowns,
+// which we swap for the pass' shared overdef sets so a deep peel doesn't hold a private copy of each.
+void PeelIteration::compactValues() {
+
+  if(!BBs)
+    return;
+
+  uint64_t shared = 0;
+
+  for(uint32_t i = 0; i != nBBs; ++i) {
+
+    ShadowBB* BB = BBs[i];
+    if(!BB)
+      continue;
+
+    for(uint32_t j = 0, jlim = BB->insts.size(); j != jlim; ++j) {
+
+      ShadowInstruction* SI = &BB->insts[j];
+      ImprovedValSetSingle* IVS = dyn_cast_or_null<ImprovedValSetSingle>(SI->i.PB);
+      if(!IVS || !IVS->Overdef || isSharedIVS(IVS))
+	continue;
+
+      SI->i.PB = &pass->sharedOverdefIVS[IVS->SetType];
+      deleteIVS(IVS);
+      ++shared;
+
+    }
+
+  }
+
+  if(shared) {
+    ++pass->stats.compactedIterations;
+    pass->stats.sharedValueSets += shared;
+  }
+
+}
+
 // Set the block-local store for BBI to S. 'kind' is used to implement half-assed polymorphism, since TLLocalStore
 // and DSELocalStore don't have a common base class at the moment.
 void PeelIteration::setExitingStore(void* S, ShadowBBInvar* BBI, const ShadowLoopInvar* exitLoop, StoreKind kind) {
@@ -413,7 +462,11 @@ bool IntegrationAttempt::analyseBlock(uint32_t& blockIdx, bool inLoopAnalyser, b
     // Now explore the loop, if possible.
     // At the moment can't ever happen inside the loop analyser.
     PeelAttempt* LPA = 0;
-    if((!inLoopAnalyser) && (LPA = getOrCreatePeelAttempt(BBL))) {
+    ConcreteLoopRun* ConcreteRun = 0;
+    if((!inLoopAnalyser) && !(ConcreteRun = runLoopConcretely(BBL)))
+      LPA = getOrCreatePeelAttempt(BBL);
+
+    if(LPA) {
 
       // Give the preheader an extra reference in case we need that store
       // to calculate a general version of the loop body if it doesn't terminate.
@@ -493,6 +546,10 @@ bool IntegrationAttempt::analyseBlock(uint32_t& blockIdx, bool inLoopAnalyser, b
 	findTentativeLoadsInUnboundedLoop(BBL, /* commit disabled here = */ false, /* second pass = */ false);
 	tryKillStoresInUnboundedLoop(BBL, /* commit disabled here = */ false, /* disable writes = */ false);
 
+	// The loop ran concretely rather than being peeled: apply its results at the exit.
+	if(ConcreteRun)
+	  applyConcreteLoopRun(ConcreteRun);
+
       }
 	
     }
@@ -548,13 +605,14 @@ bool IntegrationAttempt::analyseBlock(uint32_t& blockIdx, bool inLoopAnalyser, b
     // Loop headers and entry blocks are given their stores in other ways
     // If doBlockStoreMerge returned false this block isn't currently reachable.
     // See comments in that function for reasons why that can happen.
-    if(!doBlockStoreMerge(BB))
+    SmallVector<ShadowBB*, 4> incomingBlocks;
+    if(!doBlockStoreMerge(BB, inLoopAnalyser ? 0 : &incomingBlocks))
       return false;
 
     if(!inLoopAnalyser) {
 
-      doTLStoreMerge(BB);
-      doDSEStoreMerge(BB);
+      doTLStoreMerge(BB, incomingBlocks);
+      doDSEStoreMerge(BB, incomingBlocks);
 
     }
 
@@ -648,6 +706,8 @@ bool IntegrationAttempt::analyseExpandableCall(ShadowInstruction* SI, bool& chan
 	doDSECallMerge(SI->parent, IA);
 
 	IA->finaliseAndCommit(inLoopAnalyser);
+	pass->noteCallCommitted();
+	pass->noteMemoryReportPoint();
 
       }
       
@@ -664,6 +724,69 @@ bool IntegrationAttempt::analyseExpandableCall(ShadowInstruction* SI, bool& chan
 
 }
 
+// Instructions whose result depends only on their operands' values, without touching the store,
+// the heap or runtime-check state, and which are therefore safe for the sparse loop analyser to skip.
+// Pointer comparisons and pointer/int casts are excluded because they may set needsRuntimeCheck
+// or depend on allocation state.
+static bool isSparseLoopCandidate(ShadowInstruction* SI) {
+
+  Instruction* I = SI->invar->I;
+
+  if(isa<BinaryOperator>(I))
+    return true;
+
+  switch(I->getOpcode()) {
+
+  case Instruction::PtrToInt:
+  case Instruction::IntToPtr:
+  case Instruction::ICmp:
+    return false;
+  case Instruction::GetElementPtr:
+  case Instruction::Select:
+  case Instruction::FCmp:
+  case Instruction::ExtractValue:
+  case Instruction::InsertValue:
+    return true;
+  default:
+    return isa<CastInst>(I);
+
+  }
+
+}
+
+// Can the loop analyser skip re-evaluating SI this time around? True if SI has been evaluated during this
+// loop analysis session and none of its instruction or argument operands have changed since.
+static bool canSkipLoopReevaluation(LLPEAnalysisPass* pass, ShadowInstruction* SI) {
+
+  DenseMap<ShadowInstruction*, uint64_t>::iterator it = pass->sparseLastEval.find(SI);
+  if(it == pass->sparseLastEval.end())
+    return false;
+
+  // Wholly unknown results (other than overdef, which tryEvaluate short-circuits anyway)
+  // have escaped their operands in the block store, which must be redone each time around.
+  if(!SI->i.PB)
+    return false;
+  if(ImprovedValSetSingle* IVS = dyn_cast<ImprovedValSetSingle>(SI->i.PB)) {
+    if(!IVS->isInitialised())
+      return false;
+    if(IVS->isWhollyUnknown() && !IVS->Overdef)
+      return false;
+  }
+
+  for(uint32_t i = 0, ilim = SI->getNumOperands(); i != ilim; ++i) {
+
+    ShadowValue Op = SI->getOperand(i);
+    if(Op.isInst() || Op.isArg()) {
+      if(pass->sparseLastChanged.lookup(Op) >= it->second)
+	return false;
+    }
+
+  }
+
+  return true;
+
+}
+
 // Analyse instruction SI in this context. inLoopAnalyser and anyLoop have the same meanings as in InlineAttempt::analyseWithArgs above.
 // loadedVarargsHere indicates this instruction read a vararg. bail indicates that this path ended in an unreachable instruction.
 bool IntegrationAttempt::analyseInstruction(ShadowInstruction* SI, bool inLoopAnalyser, bool inAnyLoop, bool& loadedVarargsHere, bool& bail) {
@@ -684,8 +807,14 @@ bool IntegrationAttempt::analyseInstruction(ShadowInstruction* SI, bool inLoopAn
   case Instruction::Fence:
     return false;
   case Instruction::Alloca:
-    executeAllocaInst(SI);
-    return false;
+    {
+      // An alloca's result is fixed once it has been created.
+      bool isNew = !SI->i.PB;
+      executeAllocaInst(SI);
+      if(isNew)
+	pass->noteValueChanged(ShadowValue(SI));
+      return false;
+    }
   case Instruction::Store:
     executeStoreInst(SI);
     return false;
@@ -699,10 +828,20 @@ bool IntegrationAttempt::analyseInstruction(ShadowInstruction* SI, bool inLoopAn
 	  break;
       }
 
-      if(tryPromoteOpenCall(SI))
+      // These paths and executeUnexpandedCall below write SI's result directly;
+      // conservatively assume it changed.
+      if(tryPromoteOpenCall(SI)) {
+	pass->noteValueChanged(ShadowValue(SI));
+	return false;
+      }
+      if(tryResolveVFSCall(SI)) {
+	pass->noteValueChanged(ShadowValue(SI));
 	return false;
-      if(tryResolveVFSCall(SI))
+      }
+      if((!getInlineAttempt(SI)) && tryEvaluateStringCall(SI)) {
+	pass->noteValueChanged(ShadowValue(SI));
 	return false;
+      }
       
       bool isExpanded = analyseExpandableCall(SI, changed, inLoopAnalyser, inAnyLoop);
       if(isExpanded) {
@@ -721,6 +860,7 @@ bool IntegrationAttempt::analyseInstruction(ShadowInstruction* SI, bool inLoopAn
 	// For special calls like malloc this might define a return value;
 	// for others it is responsible for placing an Overdef return.
 	executeUnexpandedCall(SI);
+	pass->noteValueChanged(ShadowValue(SI));
 
       }
 
@@ -737,8 +877,23 @@ bool IntegrationAttempt::analyseInstruction(ShadowInstruction* SI, bool inLoopAn
 
   }
 
-  if(!bail)
+  if(!bail) {
+
+    bool sparseCandidate = inLoopAnalyser && pass->inSparseLoopSession() && isSparseLoopCandidate(SI);
+    if(sparseCandidate && canSkipLoopReevaluation(pass, SI)) {
+      ++pass->stats.loopInstsSkipped;
+      return false;
+    }
+
+    if(inLoopAnalyser && pass->inSparseLoopSession())
+      ++pass->stats.loopInstsEvaluated;
+
     changed |= tryEvaluate(ShadowValue(SI), inLoopAnalyser, loadedVarargsHere);
+
+    if(sparseCandidate)
+      pass->noteValueEvaluated(SI);
+
+  }
   return changed;
 
 }
@@ -748,6 +903,7 @@ bool IntegrationAttempt::analyseBlockInstructions(ShadowBB* BB, bool inLoopAnaly
 
   bool anyChange = false;
   bool loadedVarargsHere = false;
+  uint64_t evaluatedBefore = pass->stats.loopInstsEvaluated;
 
   for(uint32_t i = 0, ilim = BB->insts.size(); i != ilim; ++i) {
 
@@ -755,7 +911,7 @@ bool IntegrationAttempt::analyseBlockInstructions(ShadowBB* BB, bool inLoopAnaly
     bool bail = false;
     anyChange |= analyseInstruction(SI, inLoopAnalyser, inAnyLoop, loadedVarargsHere, bail);
     if(bail)
-      return anyChange;
+      break;
 
     if(!inLoopAnalyser) {
 
@@ -776,6 +932,14 @@ bool IntegrationAttempt::analyseBlockInstructions(ShadowBB* BB, bool inLoopAnaly
 
   }
 
+  if(inLoopAnalyser && pass->inSparseLoopSession()) {
+    // Count the block as skipped if every instruction that reached tryEvaluate was skipped.
+    if(pass->stats.loopInstsEvaluated == evaluatedBefore)
+      ++pass->stats.loopBlocksSkipped;
+    else
+      ++pass->stats.loopBlocksAnalysed;
+  }
+
   return anyChange;
 
 }
@@ -845,6 +1009,91 @@ void IntegrationAttempt::releaseLatchStores(const ShadowLoopInvar* L) {
       release_assert("Releasing store from dead latch?");
       LBB->derefStores();
     }
+    pass->releaseHeaderMerge(this, L);
+  }
+
+}
+
+// Drop a memoised header merge, if any.
+void LLPEAnalysisPass::releaseHeaderMerge(IntegrationAttempt* IA, const ShadowLoopInvar* L) {
+
+  DenseMap<std::pair<IntegrationAttempt*, const ShadowLoopInvar*>, HeaderMergeCacheEntry>::iterator findit =
+    headerMergeCache.find(std::make_pair(IA, L));
+  if(findit == headerMergeCache.end())
+    return;
+
+  HeaderMergeCacheEntry Entry = findit->second;
+  headerMergeCache.erase(findit);
+
+  if(Entry.mergedStore)
+    Entry.mergedStore->dropReference();
+
+}
+
+// Give loop L's header the merge of its latch and preheader stores, consuming a reference to each
+// like an ordinary block merge. Re-analysing a nested loop often presents the same pair of maps as
+// last time, so with -llpe-header-merge-cache the most recent inputs at each header are remembered
+// by address and version. Only when they recur do we keep the merged map, which then costs a
+// reference (and so a copy on the header's first write); the inputs are never referenced, so a
+// merge may still reuse one of them in place.
+void IntegrationAttempt::mergeLoopHeaderStores(const ShadowLoopInvar* L, ShadowBB* LBB, ShadowBB* PHBB, ShadowBB* HBB) {
+
+  OrdinaryLocalStore* latchStore = LBB->localStore;
+  OrdinaryLocalStore* preheaderStore = PHBB->localStore;
+  std::pair<IntegrationAttempt*, const ShadowLoopInvar*> Key(this, L);
+
+  OrdinaryMerger V(this, false);
+  V.visit(LBB, 0, false);
+  V.visit(PHBB, 0, false);
+
+  // Nothing to merge.
+  if(latchStore == preheaderStore || !pass->headerMergeCaching) {
+    V.doMerge();
+    HBB->localStore = V.newMap;
+    return;
+  }
+
+  uint64_t latchVersion = latchStore->version, preheaderVersion = preheaderStore->version;
+
+  DenseMap<std::pair<IntegrationAttempt*, const ShadowLoopInvar*>, HeaderMergeCacheEntry>::iterator findit =
+    pass->headerMergeCache.find(Key);
+  bool seenBefore = findit != pass->headerMergeCache.end() &&
+    findit->second.latchStore == latchStore && findit->second.latchVersion == latchVersion &&
+    findit->second.preheaderStore == preheaderStore && findit->second.preheaderVersion == preheaderVersion;
+
+  if(seenBefore && findit->second.mergedStore) {
+
+    ++pass->stats.headerMergeCacheHits;
+    HBB->localStore = findit->second.mergedStore;
+    ++HBB->localStore->refCount;
+    latchStore->dropReference();
+    preheaderStore->dropReference();
+    return;
+
+  }
+
+  ++pass->stats.headerMergeCacheMisses;
+
+  V.doMerge();
+  HBB->localStore = V.newMap;
+
+  if(seenBefore) {
+
+    // Second sighting: worth keeping the result.
+    findit->second.mergedStore = V.newMap;
+    ++V.newMap->refCount;
+
+  }
+  else {
+
+    pass->releaseHeaderMerge(this, L);
+    HeaderMergeCacheEntry& Entry = pass->headerMergeCache[Key];
+    Entry.latchStore = latchStore;
+    Entry.latchVersion = latchVersion;
+    Entry.preheaderStore = preheaderStore;
+    Entry.preheaderVersion = preheaderVersion;
+    Entry.mergedStore = 0;
+
   }
 
 }
@@ -866,6 +1115,9 @@ bool IntegrationAttempt::analyseLoop(const ShadowLoopInvar* L, bool nestedLoop)
 
   LFV3(errs() << "Loop " << L->getHeader()->getName() << " refcount at entry: " << PHBB->localStore->refCount << "\n");
 
+  // Nested loops and calls share the outermost loop's analysis session.
+  ++pass->loopAnalyserDepth;
+
   // Stop iterating if we show that the latch edge died!
   while(anyChange && (firstIter || !edgeIsDead(getBBInvar(L->latchIdx), HBB->invar))) {
     
@@ -909,29 +1161,28 @@ bool IntegrationAttempt::analyseLoop(const ShadowLoopInvar* L, bool nestedLoop)
 	firstIter = false;
       }
 
-      OrdinaryMerger V(this, false);
       FDStoreMerger V2;
 
       if(!firstIter) {
 
 	// Merge the latch store with the preheader store:
 	release_assert(LBB && "Iterating on a loop with a dead latch block?");
-	V.visit(LBB, 0, false);
+	mergeLoopHeaderStores(L, LBB, PHBB, HBB);
 	V2.visit(LBB, 0, false);
-	V.visit(PHBB, 0, false);
 	V2.visit(PHBB, 0, false);
 
       }
       else {
 
 	// Give the header block the store from the preheader
+	OrdinaryMerger V(this, false);
 	V.visit(PHBB, 0, false);
+	V.doMerge();
+	HBB->localStore = V.newMap;
 	V2.visit(PHBB, 0, false);
 
       }
 
-      V.doMerge();
-      HBB->localStore = V.newMap;
       V2.doMerge();
       HBB->fdStore = V2.newStore;
 
@@ -997,11 +1248,42 @@ bool IntegrationAttempt::analyseLoop(const ShadowLoopInvar* L, bool nestedLoop)
     --pendingEdges;
 
   LFV3(errs() << "Loop " << L->getHeader()->getName() << " refcount at exit: " << PHBB->localStore->refCount << "\n");
+
+  LoopConvergenceStats& Conv = pass->loopConvergence[getBBInvar(L->headerIdx)->BB];
+  ++Conv.analyses;
+  Conv.totalIterations += iters;
+  if(iters > Conv.maxIterations)
+    Conv.maxIterations = iters;
+
+  if((--pass->loopAnalyserDepth) == 0) {
+    // Session state is keyed by shadow objects, which may be freed and reallocated afterwards.
+    pass->sparseLastChanged.clear();
+    pass->sparseLastEval.clear();
+    pass->loopGrowthSteps.clear();
+    pass->clearLoadForwardCache();
+    // Normally released along with latch stores; make sure no maps outlive the session.
+    while(!pass->headerMergeCache.empty())
+      pass->releaseHeaderMerge(pass->headerMergeCache.begin()->first.first, pass->headerMergeCache.begin()->first.second);
+  }
   
   return everChanged;
 
 }
 
+// Report how many times each loop's general case was analysed and how many iterations it took to converge.
+void LLPEAnalysisPass::printLoopConvergence(raw_ostream& Out) {
+
+  for(DenseMap<BasicBlock*, LoopConvergenceStats>::iterator it = loopConvergence.begin(),
+	itend = loopConvergence.end(); it != itend; ++it) {
+
+    LoopConvergenceStats& Conv = it->second;
+    Out << "Loop " << it->first->getParent()->getName() << " / " << it->first->getName() << ": "
+	<< Conv.analyses << " analyses, " << Conv.totalIterations << " iterations, max " << Conv.maxIterations << "\n";
+
+  }
+
+}
+
 // Run this function instance through the 'interpreter' without changing findings about any of the instructions etc.
 // Used when a function instance is being shared as we have detected that all relevant state matches a previously-
 // analysed version.
@@ -1027,6 +1309,7 @@ void IntegrationAttempt::executeLoop(const ShadowLoopInvar* ThisL) {
     LBB->derefStores();
 
   }
+  pass->releaseHeaderMerge(this, ThisL);
 
   // No need for extra references: we simply execute the residual loop once
   // as fixpoints have already been established about what is stored.
@@ -1171,7 +1454,7 @@ void IntegrationAttempt::executeBlock(ShadowBB* BB) {
 	    return;
 
 	}
-	else {
+	else if(!tryEvaluateStringCall(SI)) {
 	  
 	  executeUnexpandedCall(SI);
 
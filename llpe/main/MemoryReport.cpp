@@ -0,0 +1,559 @@
+//===-- MemoryReport.cpp --------------------------------------------------===//
+//
+//                                  LLPE
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.txt for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Analysis/LLPE.h"
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Process.h"
+
+#include <algorithm>
+#include <functional>
+
+#define DEBUG_TYPE "llpe-misc"
+
+using namespace llvm;
+
+// Memory usage snapshots. Each is one line of JSON appended to -llpe-memory-report, taken when the root
+// context's analysis completes, when the analysis budget runs out, and every -llpe-memory-report-interval
+// committed calls. A snapshot gives:
+//
+// * per store kind (ordinary, DSE, TL, FD): live maps, frames, frame chunks and heap tree nodes, the bytes
+//   they hold, their sharing ratio (references per distinct object) and how many COW breaks there have been;
+// * ImprovedValSetMulti and text cache usage;
+// * the context tree, with each context's shadow blocks, instruction values and the stack frames it owns,
+//   plus a subtree total. Heap trees are shared between all contexts so are only reported per store kind.
+//
+// Byte counts are estimates made from object and container sizes; interval maps are counted by interval.
+
+static cl::opt<std::string> MemoryReportFile("llpe-memory-report", cl::init(""));
+static cl::opt<unsigned> MemoryReportInterval("llpe-memory-report-interval", cl::init(0));
+
+FDStore* FDStore::liveStores = 0;
+
+enum ReportStoreKind {
+
+  ReportOrdinary,
+  ReportDSE,
+  ReportTL,
+  ReportStoreKinds
+
+};
+
+static const char* storeKindNames[ReportStoreKinds] = { "ordinary", "dse", "tl" };
+
+struct StoreUsage {
+
+  uint64_t maps, mapBytes;
+  uint64_t frames, frameRefs, frameBytes;
+  uint64_t chunks, chunkRefs, chunkBytes;
+  uint64_t nodes, nodeRefs, nodeBytes;
+  uint64_t leaves, leafBytes, valueBytes;
+  uint64_t mapCOWBreaks, frameCOWBreaks, chunkCOWBreaks, nodeCOWBreaks;
+
+};
+
+struct llvm::MemoryReport {
+
+  StoreUsage stores[ReportStoreKinds];
+  // Bytes of stack frames (and their chunks and values) belonging to each function context.
+  DenseMap<InlineAttempt*, uint64_t> frameBytes[ReportStoreKinds];
+
+  uint64_t multis, multiIntervals, multiBytes;
+
+  SmallPtrSet<void*, 64> visited;
+
+MemoryReport() : stores(), multis(0), multiIntervals(0), multiBytes(0) { }
+
+  uint64_t valueBytes(ImprovedValSet* IVS) {
+
+    if(!IVS)
+      return 0;
+
+    if(ImprovedValSetSingle* IVSS = dyn_cast<ImprovedValSetSingle>(IVS)) {
+
+      if(isSharedIVS(IVSS))
+	return 0;
+
+      uint64_t ret = sizeof(ImprovedValSetSingle);
+      if(IVSS->Values.capacity() > 1)
+	ret += IVSS->Values.capacity() * sizeof(ImprovedVal);
+      return ret;
+
+    }
+
+    ImprovedValSetMulti* IVM = cast<ImprovedValSetMulti>(IVS);
+    if(!visited.insert(IVM).second)
+      return 0;
+
+    uint64_t intervals = 0;
+    for(ImprovedValSetMulti::MapIt it = IVM->Map.begin(), itend = IVM->Map.end(); it != itend; ++it)
+      ++intervals;
+
+    uint64_t ret = sizeof(ImprovedValSetMulti) + intervals * (2 * sizeof(uint64_t) + sizeof(ImprovedValSetSingle));
+
+    ++multis;
+    multiIntervals += intervals;
+    multiBytes += ret;
+
+    return ret + valueBytes(IVM->Underlying);
+
+  }
+
+};
+
+static void writeJSONString(raw_ostream& Out, StringRef S) {
+
+  Out << '"';
+
+  for(uint32_t i = 0, ilim = S.size(); i != ilim; ++i) {
+
+    char c = S[i];
+    switch(c) {
+    case '"':
+      Out << "\\\"";
+      break;
+    case '\\':
+      Out << "\\\\";
+      break;
+    case '\n':
+      Out << "\\n";
+      break;
+    case '\t':
+      Out << "\\t";
+      break;
+    default:
+      if((unsigned char)c < 0x20)
+	Out << format("\\u%04x", (unsigned)c);
+      else
+	Out << c;
+    }
+
+  }
+
+  Out << '"';
+
+}
+
+static void writeRatio(raw_ostream& Out, uint64_t refs, uint64_t objects) {
+
+  Out << format("%.3f", objects ? ((double)refs) / objects : 0.0);
+
+}
+
+// Bytes held by a store entry beyond the entry itself.
+
+static uint64_t childExtraBytes(LocStore& LS, MemoryReport& R) {
+
+  return R.valueBytes(LS.store);
+
+}
+
+static uint64_t childExtraBytes(DSEMapPointer& P, MemoryReport& R) {
+
+  if(!P.M || !R.visited.insert(P.M).second)
+    return 0;
+
+  uint64_t intervals = 0;
+  for(DSEMapTy::iterator it = P.M->begin(), itend = P.M->end(); it != itend; ++it)
+    ++intervals;
+
+  return sizeof(DSEMapTy) + intervals * (2 * sizeof(uint64_t) + sizeof(DSEMapEntry));
+
+}
+
+static uint64_t childExtraBytes(TLMapPointer& P, MemoryReport& R) {
+
+  if(!P.M || !R.visited.insert(P.M).second)
+    return 0;
+
+  uint64_t intervals = 0;
+  for(TLMapTy::iterator it = P.M->begin(), itend = P.M->end(); it != itend; ++it)
+    ++intervals;
+
+  return sizeof(TLMapTy) + intervals * (2 * sizeof(uint64_t) + sizeof(bool));
+
+}
+
+static uint64_t extraStateBytes(OrdinaryStoreExtraState& es) {
+
+  return es.threadLocalObjects.getMemorySize() + es.noAliasOldObjects.getMemorySize() + es.unescapedObjects.getMemorySize();
+
+}
+
+static uint64_t extraStateBytes(DSEStoreExtraState&) {
+
+  return 0;
+
+}
+
+static uint64_t extraStateBytes(TLStoreExtraState&) {
+
+  return 0;
+
+}
+
+template<class ChildType, class ExtraState>
+static void accountNode(SharedTreeNode<ChildType, ExtraState>* node, uint32_t height, StoreUsage& U, MemoryReport& R) {
+
+  if(!R.visited.insert(node).second)
+    return;
+
+  ++U.nodes;
+  U.nodeRefs += node->refCount;
+  U.nodeBytes += sizeof(*node) + node->capacity * sizeof(void*);
+
+  for(uint32_t i = 0; i < HEAPTREEORDER; ++i) {
+
+    void* child = node->getChild(i);
+    if(!child)
+      continue;
+
+    if(height == 0) {
+      ++U.leaves;
+      U.leafBytes += sizeof(ChildType);
+      U.valueBytes += childExtraBytes(*((ChildType*)child), R);
+    }
+    else {
+      accountNode((SharedTreeNode<ChildType, ExtraState>*)child, height - 1, U, R);
+    }
+
+  }
+
+}
+
+template<class ChildType, class ExtraState> static void accountStores(MemoryReport& R, uint32_t kind) {
+
+  typedef LocalStoreMap<ChildType, ExtraState> MapType;
+  typedef typename MapType::FrameType FrameType;
+
+  StoreUsage& U = R.stores[kind];
+
+  for(MapType* Map = MapType::liveMaps; Map; Map = Map->nextLive) {
+
+    ++U.maps;
+    U.mapBytes += sizeof(MapType) + extraStateBytes(Map->es);
+    if(Map->frames.capacity() > 4)
+      U.mapBytes += Map->frames.capacity() * sizeof(FrameType*);
+
+    for(uint32_t i = 0, ilim = Map->frames.size(); i != ilim; ++i) {
+
+      FrameType* Frame = Map->frames[i];
+      if(!R.visited.insert(Frame).second)
+	continue;
+
+      ++U.frames;
+      U.frameRefs += Frame->refCount;
+      uint64_t bytes = sizeof(FrameType) + Frame->chunks.capacity() * sizeof(void*);
+      U.frameBytes += bytes;
+
+      for(uint32_t j = 0, jlim = Frame->chunks.size(); j != jlim; ++j) {
+
+	FrameChunk<ChildType>* Chunk = Frame->chunks[j];
+	if(!Chunk || !R.visited.insert(Chunk).second)
+	  continue;
+
+	++U.chunks;
+	U.chunkRefs += Chunk->refCount;
+	U.chunkBytes += sizeof(*Chunk);
+	bytes += sizeof(*Chunk);
+
+	for(uint32_t k = 0; k != FRAMECHUNKSIZE; ++k) {
+	  if(Chunk->slots[k].isValid()) {
+	    uint64_t extra = childExtraBytes(Chunk->slots[k], R);
+	    U.valueBytes += extra;
+	    bytes += extra;
+	  }
+	}
+
+      }
+
+      R.frameBytes[kind][Frame->IA] += bytes;
+
+    }
+
+    if(Map->heap.height)
+      accountNode(Map->heap.root, Map->heap.height - 1, U, R);
+
+  }
+
+  U.mapCOWBreaks = MapType::cowBreaks;
+  U.frameCOWBreaks = FrameType::cowBreaks;
+  U.chunkCOWBreaks = FrameChunk<ChildType>::cowBreaks;
+  U.nodeCOWBreaks = SharedTreeNode<ChildType, ExtraState>::cowBreaks;
+
+}
+
+static void writeStoreUsage(raw_ostream& Out, StoreUsage& U) {
+
+  Out << "{\"maps\": " << U.maps << ", \"mapBytes\": " << U.mapBytes;
+  Out << ", \"frames\": " << U.frames << ", \"frameBytes\": " << U.frameBytes << ", \"frameSharing\": ";
+  writeRatio(Out, U.frameRefs, U.frames);
+  Out << ", \"chunks\": " << U.chunks << ", \"chunkBytes\": " << U.chunkBytes << ", \"chunkSharing\": ";
+  writeRatio(Out, U.chunkRefs, U.chunks);
+  Out << ", \"nodes\": " << U.nodes << ", \"nodeBytes\": " << U.nodeBytes << ", \"nodeSharing\": ";
+  writeRatio(Out, U.nodeRefs, U.nodes);
+  Out << ", \"leaves\": " << U.leaves << ", \"leafBytes\": " << U.leafBytes << ", \"valueBytes\": " << U.valueBytes;
+  Out << ", \"totalBytes\": " << (U.mapBytes + U.frameBytes + U.chunkBytes + U.nodeBytes + U.leafBytes + U.valueBytes);
+  Out << ", \"cowBreaks\": {\"maps\": " << U.mapCOWBreaks << ", \"frames\": " << U.frameCOWBreaks;
+  Out << ", \"chunks\": " << U.chunkCOWBreaks << ", \"nodes\": " << U.nodeCOWBreaks << "}}";
+
+}
+
+static uint64_t getTextMapBytes(DenseMap<const Value*, std::string>* Map) {
+
+  if(!Map)
+    return 0;
+
+  uint64_t ret = Map->getMemorySize();
+  for(DenseMap<const Value*, std::string>::iterator it = Map->begin(), itend = Map->end(); it != itend; ++it)
+    ret += it->second.capacity();
+
+  return ret;
+
+}
+
+static void writeTextCacheUsage(raw_ostream& Out, LLPEAnalysisPass* pass) {
+
+  std::vector<std::pair<uint64_t, const Function*> > perFunction;
+  uint64_t total = 0;
+
+  for(DenseMap<const Function*, DenseMap<const Value*, std::string>* >::iterator it = pass->functionTextCache.begin(),
+	itend = pass->functionTextCache.end(); it != itend; ++it) {
+
+    uint64_t bytes = getTextMapBytes(it->second) + getTextMapBytes(pass->briefFunctionTextCache.lookup(it->first));
+    perFunction.push_back(std::make_pair(bytes, it->first));
+    total += bytes;
+
+  }
+
+  uint64_t otherBytes = pass->GVCache.getMemorySize() + pass->GVCacheBrief.getMemorySize() + pass->shortHeaders.getMemorySize();
+  for(DenseMap<const GlobalVariable*, std::string>::iterator it = pass->GVCache.begin(), itend = pass->GVCache.end(); it != itend; ++it)
+    otherBytes += it->second.capacity();
+  for(DenseMap<const GlobalVariable*, std::string>::iterator it = pass->GVCacheBrief.begin(), itend = pass->GVCacheBrief.end(); it != itend; ++it)
+    otherBytes += it->second.capacity();
+  for(DenseMap<IntegrationAttempt*, std::string>::iterator it = pass->shortHeaders.begin(), itend = pass->shortHeaders.end(); it != itend; ++it)
+    otherBytes += it->second.capacity();
+
+  std::sort(perFunction.begin(), perFunction.end(), std::greater<std::pair<uint64_t, const Function*> >());
+
+  Out << "{\"functionBytes\": " << total << ", \"otherBytes\": " << otherBytes << ", \"largestFunctions\": [";
+  for(uint32_t i = 0, ilim = std::min((uint32_t)perFunction.size(), 20U); i != ilim; ++i) {
+
+    if(i != 0)
+      Out << ", ";
+    Out << "{\"function\": ";
+    writeJSONString(Out, perFunction[i].second->getName());
+    Out << ", \"bytes\": " << perFunction[i].first << "}";
+
+  }
+  Out << "]}";
+
+}
+
+// Write this context's usage and that of its children; return the subtree's total bytes.
+uint64_t IntegrationAttempt::dumpMemoryUsage(raw_ostream& Out, MemoryReport& R) {
+
+  Out << "{\"context\": ";
+  writeJSONString(Out, getShortHeader());
+
+  // Shared function instances are reported under their first caller only.
+  if(!R.visited.insert(this).second) {
+    Out << ", \"shared\": true, \"subtreeBytes\": 0}";
+    return 0;
+  }
+
+  InlineAttempt* Root = getFunctionRoot();
+
+  uint64_t blocks = 0, insts = 0, valueBytes = 0;
+  uint64_t arenaBytes = shadowArena.getBytesAllocated();
+
+  if(BBs) {
+
+    arenaBytes += nBBs * sizeof(ShadowBB*);
+
+    for(uint32_t i = 0; i != nBBs; ++i) {
+
+      ShadowBB* BB = BBs[i];
+      if(!BB)
+	continue;
+
+      ++blocks;
+      insts += BB->insts.size();
+      for(uint32_t j = 0, jlim = BB->insts.size(); j != jlim; ++j)
+	valueBytes += R.valueBytes(BB->insts[j].i.PB);
+
+    }
+
+  }
+
+  if(Root == this) {
+
+    for(uint32_t i = 0, ilim = Root->argShadows.size(); i != ilim; ++i)
+      valueBytes += R.valueBytes(Root->argShadows[i].i.PB);
+    valueBytes += R.valueBytes(Root->returnValue);
+
+  }
+
+  uint64_t total = arenaBytes + valueBytes;
+
+  Out << ", \"kind\": " << (Root == this ? "\"call\"" : "\"iteration\"");
+  Out << ", \"committed\": " << (isCommitted() ? "true" : "false");
+  Out << ", \"released\": " << (BBs ? "false" : "true");
+  Out << ", \"blocks\": " << blocks << ", \"instructions\": " << insts;
+  Out << ", \"shadowBytes\": " << arenaBytes << ", \"valueBytes\": " << valueBytes;
+
+  if(Root == this) {
+
+    Out << ", \"frameBytes\": {";
+    for(uint32_t k = 0; k != ReportStoreKinds; ++k) {
+      uint64_t bytes = R.frameBytes[k].lookup(Root);
+      total += bytes;
+      Out << (k ? ", " : "") << "\"" << storeKindNames[k] << "\": " << bytes;
+    }
+    Out << "}";
+
+  }
+
+  Out << ", \"children\": [";
+
+  if(BBs) {
+
+    bool first = true;
+    for(IAIterator it = child_calls_begin(this), itend = child_calls_end(this); it != itend; ++it) {
+      if(!first)
+	Out << ", ";
+      first = false;
+      total += it->second->dumpMemoryUsage(Out, R);
+    }
+
+  }
+
+  Out << "], \"loops\": [";
+
+  bool first = true;
+  for(DenseMap<const ShadowLoopInvar*, PeelAttempt*>::iterator it = peelChildren.begin(), itend = peelChildren.end(); it != itend; ++it) {
+    if(!first)
+      Out << ", ";
+    first = false;
+    total += it->second->dumpMemoryUsage(Out, R);
+  }
+
+  Out << "], \"subtreeBytes\": " << total << "}";
+
+  return total;
+
+}
+
+uint64_t PeelAttempt::dumpMemoryUsage(raw_ostream& Out, MemoryReport& R) {
+
+  uint64_t total = iterationArena.getBytesAllocated();
+
+  Out << "{\"loop\": ";
+  writeJSONString(Out, getLName());
+  Out << ", \"shadowBytes\": " << total << ", \"iterations\": [";
+
+  for(uint32_t i = 0, ilim = Iterations.size(); i != ilim; ++i) {
+    if(i != 0)
+      Out << ", ";
+    total += Iterations[i]->dumpMemoryUsage(Out, R);
+  }
+
+  Out << "], \"subtreeBytes\": " << total << "}";
+
+  return total;
+
+}
+
+static void writeMemorySnapshot(raw_ostream& Out, LLPEAnalysisPass* pass, const char* reason) {
+
+  MemoryReport R;
+
+  // Stores first, so that frame usage can be attributed to contexts below.
+  accountStores<LocStore, OrdinaryStoreExtraState>(R, ReportOrdinary);
+  accountStores<DSEMapPointer, DSEStoreExtraState>(R, ReportDSE);
+  accountStores<TLMapPointer, TLStoreExtraState>(R, ReportTL);
+
+  uint64_t fdStores = 0, fdRefs = 0, fdBytes = 0;
+  for(FDStore* FDS = FDStore::liveStores; FDS; FDS = FDS->nextLive) {
+    ++fdStores;
+    fdRefs += FDS->refCount;
+    fdBytes += sizeof(FDStore) + FDS->fds.capacity() * sizeof(FDState);
+  }
+
+  Out << "{\"reason\": ";
+  writeJSONString(Out, reason);
+  Out << ", \"mallocBytes\": " << (uint64_t)sys::Process::GetMallocUsage() << ", \"residentBytes\": " << getResidentBytes();
+  Out << ", \"contextsCreated\": " << pass->IAs.size() << ", \"heapSlots\": " << pass->heap.size();
+
+  Out << ", \"stores\": {";
+  for(uint32_t k = 0; k != ReportStoreKinds; ++k) {
+    Out << "\"" << storeKindNames[k] << "\": ";
+    writeStoreUsage(Out, R.stores[k]);
+    Out << ", ";
+  }
+  Out << "\"fd\": {\"stores\": " << fdStores << ", \"bytes\": " << fdBytes << ", \"sharing\": ";
+  writeRatio(Out, fdRefs, fdStores);
+  Out << "}}";
+
+  Out << ", \"textCaches\": ";
+  writeTextCacheUsage(Out, pass);
+
+  Out << ", \"contexts\": ";
+  if(pass->RootIA)
+    pass->RootIA->dumpMemoryUsage(Out, R);
+  else
+    Out << "null";
+
+  // Value sets are counted as they're found, so write these last.
+  Out << ", \"multiValueSets\": {\"count\": " << R.multis << ", \"intervals\": " << R.multiIntervals << ", \"bytes\": " << R.multiBytes << "}}";
+
+}
+
+void LLPEAnalysisPass::writeMemoryReport(const char* reason) {
+
+  if(MemoryReportFile.empty())
+    return;
+
+  // Append, so that earlier snapshots survive if we later run out of memory.
+  std::error_code EC;
+  raw_fd_ostream Out(MemoryReportFile, EC, memoryReportStarted ? sys::fs::F_Append : sys::fs::F_None);
+  if(EC) {
+    errs() << "Failed to open " << MemoryReportFile << ": " << EC.message() << "\n";
+    return;
+  }
+
+  memoryReportStarted = true;
+  writeMemorySnapshot(Out, this, reason);
+  Out << "\n";
+
+}
+
+// Called each time a call has been finalised and committed outside the loop analyser.
+void LLPEAnalysisPass::noteMemoryReportPoint() {
+
+  if(MemoryReportFile.empty() || !MemoryReportInterval)
+    return;
+
+  if(++callsSinceMemoryReport < MemoryReportInterval)
+    return;
+
+  callsSinceMemoryReport = 0;
+  writeMemoryReport("interval");
+
+}
+
+// For use from a debugger.
+void LLPEAnalysisPass::dumpMemoryUsage() {
+
+  writeMemorySnapshot(errs(), this, "debug");
+  errs() << "\n";
+
+}
@@ -216,30 +216,6 @@ std::string PeelAttempt::nestingIndent() const {
   return ind(nesting_depth * 2);
 }
 
-// Debug functions:
-
-void IntegrationAttempt::dumpMemoryUsage(int indent) {
-
-  errs() << ind(indent);
-  describeBrief(errs());
-
-  for(IAIterator II = child_calls_begin(this), IE = child_calls_end(this); II != IE; II++) {
-    II->second->dumpMemoryUsage(indent+2);
-  } 
-  for(DenseMap<const ShadowLoopInvar*, PeelAttempt*>::iterator PI = peelChildren.begin(), PE = peelChildren.end(); PI != PE; PI++) {
-    PI->second->dumpMemoryUsage(indent+1);
-  }
-
-}
-
-void PeelAttempt::dumpMemoryUsage(int indent) {
-
-  errs() << ind(indent) << "Loop " << getLName() << " (" << Iterations.size() << " iterations)\n";
-  for(std::vector<PeelIteration*>::iterator it = Iterations.begin(), it2 = Iterations.end(); it != it2; ++it)
-    (*it)->dumpMemoryUsage(indent+1);
-
-}
-
 // Brief descriptions for DOT / debug.
 
 std::string InlineAttempt::getShortHeader() {
@@ -45,9 +45,14 @@ DenseMap<const Value*, std::string>& LLPEAnalysisPass::getFunctionCache(const Fu
 
 }
 
-// Build a mapping for every GlobalValue to its text representation.
+// Build a mapping for every GlobalValue to its text representation. This prints the whole
+// module's globals at once, so we put it off until something actually needs describing.
 void LLPEAnalysisPass::populateGVCaches(const Module* M) {
-  
+
+  if(gvCachesPopulated)
+    return;
+
+  gvCachesPopulated = true;
   getGVText(persistPrinter, M, GVCache, GVCacheBrief);
 
 }
@@ -78,6 +83,7 @@ void LLPEAnalysisPass::printValue(raw_ostream& ROS, const Value* V, bool brief)
     }
     else if(const GlobalVariable* GV = dyn_cast<GlobalVariable>(V)) {
 
+      populateGVCaches(GV->getParent());
       DenseMap<const GlobalVariable*, std::string>& Map = getGVCache(brief);
       ROS << Map[GV];
       return;
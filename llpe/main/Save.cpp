@@ -354,6 +354,30 @@ void IntegrationAttempt::commitCFG() {
 
       }
 
+      // A loop we ran concretely may be replaced by a single block writing its results.
+      ConcreteLoopResult* CLR = getConcreteLoopResult(BB->invar->naturalScope);
+      if((!PA) && CLR && canReplaceConcreteLoop(BB->invar->naturalScope, CLR)) {
+
+	const ShadowLoopInvar* skipL = BB->invar->naturalScope;
+
+	for(unsigned j = i + 1; j != nBBs && skipL->contains(getBBInvar(j + BBsOffset)->naturalScope); ++j)
+	  createFailedBlock(j + BBsOffset);
+
+	std::string Name;
+	if(VerboseNames) {
+	  raw_string_ostream RSO(Name);
+	  RSO << getCommittedBlockPrefix() << BB->invar->BB->getName() << ".concrete";
+	}
+
+	CLR->commitBlock = createBasicBlock(F.getContext(), Name, CF, false, false);
+
+	while(i < nBBs && skipL->contains(getBBInvar(i + BBsOffset)->naturalScope))
+	  ++i;
+	--i;
+	continue;
+
+      }
+
     }
     
     // Skip loop-entry processing until we're back in local scope.
@@ -573,8 +597,8 @@ Value* IntegrationAttempt::getCommittedValue(ShadowValue SV) {
     return SV.u.GV->G;
   case SHADOWVAL_INST: 
     {
-      release_assert(SV.u.I->committedVal && "Instruction depends on uncommitted instruction");
-      return SV.u.I->committedVal;
+      release_assert(SV.u.I->getCommittedVal() && "Instruction depends on uncommitted instruction");
+      return SV.u.I->getCommittedVal();
     }
   case SHADOWVAL_ARG:
     {
@@ -739,6 +763,9 @@ BasicBlock* IntegrationAttempt::getSuccessorBB(ShadowBB* BB, uint32_t succIdx, b
       PeelAttempt* PA;
       if((PA = getPeelAttempt(SuccBBI->naturalScope)) && PA->isTerminated() && PA->isEnabled())
 	return PA->Iterations[0]->getBB(*SuccBBI)->committedBlocks.front().specBlock;
+      ConcreteLoopResult* CLR = getConcreteLoopResult(SuccBBI->naturalScope);
+      if(CLR && CLR->commitBlock)
+	return CLR->commitBlock;
     }
 
     // Otherwise loop unexpanded or disabled: jump direct to the residual loop.
@@ -848,7 +875,8 @@ void PeelIteration::emitPHINode(ShadowBB* BB, ShadowInstruction* I, BasicBlock*
     ShadowValue SourceV = getLoopHeaderForwardedOperand(I);
 
     PHINode* NewPN;
-    I->committedVal = NewPN = makePHI(I->invar->I->getType(), VerboseNames ? "header" : "", emitBB);
+    NewPN = makePHI(I->invar->I->getType(), VerboseNames ? "header" : "", emitBB);
+    I->setCommittedVal(NewPN);
     ShadowBB* SourceBB;
 
     if(iterationCount == 0) {
@@ -935,7 +963,8 @@ void IntegrationAttempt::populatePHINode(ShadowBB* BB, ShadowInstruction* I, PHI
 void IntegrationAttempt::emitPHINode(ShadowBB* BB, ShadowInstruction* I, BasicBlock* emitBB) {
 
   PHINode* NewPN;
-  I->committedVal = NewPN = makePHI(I->invar->I->getType(), "", emitBB);
+  NewPN = makePHI(I->invar->I->getType(), "", emitBB);
+  I->setCommittedVal(NewPN);
 
   // Special case: emitting the header PHI of a residualised loop.
   // Make an empty node for the time being; this will be revisted once the loop body is emitted
@@ -951,9 +980,9 @@ void IntegrationAttempt::fixupHeaderPHIs(ShadowBB* BB) {
 
   uint32_t i;
   for(i = 0; i < BB->insts.size() && inst_is<PHINode>(&(BB->insts[i])); ++i) {
-    if((!BB->insts[i].committedVal) || !isa<PHINode>(BB->insts[i].committedVal))
+    if((!BB->insts[i].getCommittedVal()) || !isa<PHINode>(BB->insts[i].getCommittedVal()))
       continue;
-    populatePHINode(BB, &(BB->insts[i]), cast<PHINode>(BB->insts[i].committedVal));
+    populatePHINode(BB, &(BB->insts[i]), cast<PHINode>(BB->insts[i].getCommittedVal()));
   }
 
 }
@@ -1257,25 +1286,25 @@ void IntegrationAttempt::emitTerminator(ShadowBB* BB, ShadowInstruction* I, Basi
 
 }
 
-// Create a constant global containing the bytes read by this ReadFile call.
+// Get a constant global containing the bytes read by this ReadFile call.
 static GlobalVariable* getFileBytesGlobal(ReadFile& RF) {
 
-  std::vector<Constant*> constBytes;
   std::string errors;
   LLVMContext& Context = GInt8->getContext();
-  if(!getFileBytes(RF.name, RF.incomingOffset, RF.readSize, constBytes, Context, errors)) {
+  Constant* ByteArray = getFileBytes(RF.name, RF.incomingOffset, RF.readSize, Context, errors);
+  if(!ByteArray) {
 
     errs() << "Failed to read file " << RF.name << " in commit\n";
     exit(1);
 
   }
 
-  ArrayType* ArrType = ArrayType::get(IntegerType::get(Context, 8), constBytes.size());
-  Constant* ByteArray = ConstantArray::get(ArrType, constBytes);
-
-  // Create a const global for the array:
+  // Create a const global for the array, or share one made for an earlier read of the same bytes:
 
-  return new GlobalVariable(*getGlobalModule(), ArrType, true, GlobalValue::InternalLinkage, ByteArray, "");
+  GlobalVariable*& GV = GlobalIHP->fileByteGlobals[ByteArray];
+  if(!GV)
+    GV = new GlobalVariable(*getGlobalModule(), ByteArray->getType(), true, GlobalValue::InternalLinkage, ByteArray, "");
+  return GV;
 
 }
 
@@ -1630,7 +1659,7 @@ void IntegrationAttempt::emitCall(ShadowBB* BB, ShadowInstruction* I, SmallVecto
 	BranchInst::Create(IA->getCommittedEntryBlock(), emitBB);
 
 	// Take the return PHI (or lack thereof) as this instruction's committed value.
-	I->committedVal = IA->returnPHI;
+	I->setCommittedVal(IA->returnPHI);
 
 	// Emit further instructions in this ShadowBB to the successor block:
 	++emitBBIter;
@@ -1734,7 +1763,7 @@ void IntegrationAttempt::emitCall(ShadowBB* BB, ShadowInstruction* I, SmallVecto
 
 	NewI->setDebugLoc(I->invar->I->getDebugLoc());
 	  
-	I->committedVal = NewI;
+	I->setCommittedVal(NewI);
 
 	if(IA->hasFailedReturnPath()) {
 
@@ -1750,7 +1779,7 @@ void IntegrationAttempt::emitCall(ShadowBB* BB, ShadowInstruction* I, SmallVecto
 	  else {
 
 	    CallFailed = ExtractValueInst::Create(NewI, ArrayRef<unsigned>(1), VerboseNames ? "retfailflag" : "", emitBB);
-	    I->committedVal = ExtractValueInst::Create(NewI, ArrayRef<unsigned>(0), VerboseNames ? "ret" : "", emitBB);
+	    I->setCommittedVal(ExtractValueInst::Create(NewI, ArrayRef<unsigned>(0), VerboseNames ? "ret" : "", emitBB));
 	    
 	  }
 
@@ -1823,7 +1852,7 @@ void IntegrationAttempt::emitCall(ShadowBB* BB, ShadowInstruction* I, SmallVecto
 	if(IA->returnPHI && IA->returnPHI->getNumIncomingValues() == 0) {
 	  IA->returnPHI->eraseFromParent();
 	  IA->returnPHI = 0;
-	  I->committedVal = UndefValue::get(IA->F.getFunctionType()->getReturnType());
+	  I->setCommittedVal(UndefValue::get(IA->F.getFunctionType()->getReturnType()));
 	}
 
 	// If it's an invoke instruction then this is the terminator!
@@ -1930,7 +1959,7 @@ Instruction* IntegrationAttempt::emitInst(ShadowBB* BB, ShadowInstruction* I, Ba
 
   // Clone all attributes:
   Instruction* newI = I->invar->I->clone();
-  I->committedVal = newI;
+  I->setCommittedVal(newI);
   emitBB->getInstList().push_back(cast<Instruction>(newI));
 
   if(isa<AllocaInst>(newI))
@@ -2298,6 +2327,39 @@ static Instruction* emitMemcpyInst(Value* To, Value* From, uint64_t Size, BasicB
 
 }
 
+// Fill in the block standing for a loop that ran concretely: copy each run of bytes the loop wrote
+// out of a constant global, then branch to the loop's exit.
+void IntegrationAttempt::commitConcreteLoop(ConcreteLoopResult* CLR) {
+
+  BasicBlock* emitBB = CLR->commitBlock;
+  Type* BytePtr = Type::getInt8PtrTy(emitBB->getContext());
+
+  for(std::vector<std::pair<ImprovedVal, Constant*> >::iterator it = CLR->writes.begin(), 
+	itend = CLR->writes.end(); it != itend; ++it) {
+
+    Value* To;
+    bool synthOK = synthCommittedPointer(0, BytePtr, it->first, emitBB, To);
+    release_assert(synthOK && "Concretely-run loop wrote an unavailable object");
+
+    GlobalVariable* CopyFrom = new GlobalVariable(*getGlobalModule(), it->second->getType(), 
+						  true, GlobalValue::InternalLinkage, it->second);
+    Constant* CopyFromPtr = ConstantExpr::getBitCast(CopyFrom, BytePtr);
+    uint64_t Size = cast<ArrayType>(it->second->getType())->getNumElements();
+    emitMemcpyInst(To, CopyFromPtr, Size, emitBB);
+
+  }
+
+  bool markUnreachable = false;
+  BasicBlock* Target = getSuccessorBB(getBB(CLR->exitFrom), CLR->exitTo, markUnreachable);
+  if(markUnreachable)
+    new UnreachableInst(emitBB->getContext(), emitBB);
+  else
+    BranchInst::Create(Target, emitBB);
+
+  ++pass->stats.concreteLoopsReplaced;
+
+}
+
 // Emit code to write (chunkBegin-chunkEnd] to I's first operand. This might be a simple
 // store, or might need a memcpy call from a composite-typed object.
 // newInstructions accumulates the stores, calls and casts required to do this,
@@ -2552,7 +2614,7 @@ void IntegrationAttempt::emitOrSynthInst(ShadowInstruction* I, ShadowBB* BB, Sma
 
   if(useCallPath) {
     emitCall(BB, I, emitBB);
-    if(I->committedVal)
+    if(I->getCommittedVal())
       return;
     // Else fall through to fill in a committed value:
   }
@@ -2575,7 +2637,7 @@ void IntegrationAttempt::emitOrSynthInst(ShadowInstruction* I, ShadowBB* BB, Sma
     Value* V;
     if(trySynthInst(I, emitBB->specBlock, V)) {
 
-      I->committedVal = V;
+      I->setCommittedVal(V);
       return;
 
     }
@@ -2615,51 +2677,19 @@ void IntegrationAttempt::commitLoopInstructions(const ShadowLoopInvar* ScopeL, u
 
       // Entering a nested loop. First write the blocks for each iteration that's being unrolled:
       PeelAttempt* PA = getPeelAttempt(BBI->naturalScope);
+      ConcreteLoopResult* CLR;
       if(PA && PA->isEnabled() && PA->isTerminated()) {
 
 	for(unsigned j = 0; j < PA->Iterations.size(); ++j)
 	  PA->Iterations[j]->commitInstructions();
 
-	SmallVector<const ShadowLoopInvar*, 4> loopStack;
-	loopStack.push_back(ScopeL);
-
-	// If the loop has terminated, skip populating the blocks in this context, but
-	// do allow any unspecialised ('failed') version of this loop and its children
-	// to populate their header PHI nodes by pulling from the specialised iterations
-	// we just committed.
-	const ShadowLoopInvar* skipL = BBI->naturalScope;
-	while(i < nBBs && skipL->contains(getBBInvar(i + BBsOffset)->naturalScope)) {
-
-	  const ShadowLoopInvar* ThisL = getBBInvar(i + BBsOffset)->naturalScope;
-	  const ShadowLoopInvar* TopL = loopStack.back();
-	  if(ThisL != loopStack.back()) {
-
-	    if((!TopL) || TopL->contains(ThisL))
-	      loopStack.push_back(ThisL);
-	    else {
-
-	      // Exiting subloops, finish failed header PHIs off:
-	      while(ThisL != loopStack.back()) {
-		
-		const ShadowLoopInvar* ExitL = loopStack.back();
-		populateFailedHeaderPHIs(ExitL);
-		loopStack.pop_back();
-		
-	      }
-
-	    }
-
-	  }
-
-	  populateFailedBlock(i + BBsOffset);
-	  ++i;
+	populateSkippedLoopFailedBlocks(ScopeL, i);
 
-	}
+      }
+      else if((CLR = getConcreteLoopResult(BBI->naturalScope)) && CLR->commitBlock) {
 
-	while(loopStack.back() != ScopeL) {
-	  populateFailedHeaderPHIs(loopStack.back());
-	  loopStack.pop_back();
-	}
+	commitConcreteLoop(CLR);
+	populateSkippedLoopFailedBlocks(ScopeL, i);
 
       }
       else {
@@ -2694,7 +2724,7 @@ void IntegrationAttempt::commitLoopInstructions(const ShadowLoopInvar* ScopeL, u
     for(j = 0; j < BB->insts.size() && inst_is<PHINode>(&(BB->insts[j])); ++j) {
       
       ShadowInstruction* I = &(BB->insts[j]);
-      I->committedVal = 0;
+      I->setCommittedVal(0);
       emitOrSynthInst(I, BB, emitPHIsTo);
 
     }
@@ -2721,7 +2751,7 @@ void IntegrationAttempt::commitLoopInstructions(const ShadowLoopInvar* ScopeL, u
     for(; j < BB->insts.size(); ++j) {
 
       ShadowInstruction* I = &(BB->insts[j]);
-      I->committedVal = 0;
+      I->setCommittedVal(0);
       emitOrSynthInst(I, BB, emitBlockIt);
 
       // This only emits "check as expected" checks: simple comparisons that ensure a value
@@ -2746,6 +2776,51 @@ void IntegrationAttempt::commitLoopInstructions(const ShadowLoopInvar* ScopeL, u
 
 }
 
+// Called with i at the header of a child loop of ScopeL whose specialised blocks in this context were
+// not committed, because they were peeled or replaced. Skip them, leaving i at the first block after the
+// loop, but do allow any unspecialised ('failed') version of this loop and its children to populate
+// their header PHI nodes by pulling from the specialised code we just committed instead.
+void IntegrationAttempt::populateSkippedLoopFailedBlocks(const ShadowLoopInvar* ScopeL, uint32_t& i) {
+
+  SmallVector<const ShadowLoopInvar*, 4> loopStack;
+  loopStack.push_back(ScopeL);
+
+  const ShadowLoopInvar* skipL = getBBInvar(i + BBsOffset)->naturalScope;
+  while(i < nBBs && skipL->contains(getBBInvar(i + BBsOffset)->naturalScope)) {
+
+    const ShadowLoopInvar* ThisL = getBBInvar(i + BBsOffset)->naturalScope;
+    const ShadowLoopInvar* TopL = loopStack.back();
+    if(ThisL != loopStack.back()) {
+
+      if((!TopL) || TopL->contains(ThisL))
+	loopStack.push_back(ThisL);
+      else {
+
+	// Exiting subloops, finish failed header PHIs off:
+	while(ThisL != loopStack.back()) {
+		
+	  const ShadowLoopInvar* ExitL = loopStack.back();
+	  populateFailedHeaderPHIs(ExitL);
+	  loopStack.pop_back();
+		
+	}
+
+      }
+
+    }
+
+    populateFailedBlock(i + BBsOffset);
+    ++i;
+
+  }
+
+  while(loopStack.back() != ScopeL) {
+    populateFailedHeaderPHIs(loopStack.back());
+    loopStack.pop_back();
+  }
+
+}
+
 // Apply the same debug tag to all of 'blocks'. Used to provide simple insight in GDB about the provenance
 // of specialised code that crashes.
 static void applyLocToBlocks(const DebugLoc& loc, const std::vector<BasicBlock*>& blocks) {
@@ -3204,6 +3279,8 @@ void IntegrationAttempt::releaseMemoryPostCommit() {
 
   peelChildren.clear();
 
+  releaseConcreteLoopResults();
+
   for(uint32_t i = BBsOffset, ilim = BBsOffset + nBBs; i != ilim; ++i) {
 
     ShadowBB* BB = getBB(i);
@@ -3240,7 +3317,7 @@ void IntegrationAttempt::releaseMemoryPostCommit() {
 
       }
 
-      delete BB;
+      freeBB(BB);
       
     }
 
@@ -3248,6 +3325,7 @@ void IntegrationAttempt::releaseMemoryPostCommit() {
 
   delete[] BBs;
   BBs = 0;
+  releaseShadowArena();
 
   commitState = COMMIT_FREED;
 
@@ -3336,6 +3414,11 @@ void InlineAttempt::finaliseAndCommit(bool inLoopAnalyser) {
 
 void LLPEAnalysisPass::commit() {
 
+  if(cachedModule) {
+    applyAnalysisCache();
+    return;
+  }
+
   if(!(omitChecks || llioDependentFiles.empty())) {
 
     // Note files that were read by specialised code, and so which must be checked for modification
@@ -3381,8 +3464,10 @@ void LLPEAnalysisPass::commit() {
     raw_fd_ostream RFO(statsFile.c_str(), error, sys::fs::F_None);
     if(error)
       errs() << "Failed to open " << statsFile << ": " << error.message() << "\n";
-    else
+    else {
       stats.print(RFO);
+      printLoopConvergence(RFO);
+    }
   }
 
   // Redirect internal callers to use the specialised fuction.
@@ -3398,6 +3483,11 @@ void LLPEAnalysisPass::commit() {
   RootIA->CommitF->takeName(&(RootIA->F));
   RootIA->F.setName(oldFName);
 
+  storeAnalysisCache(*RootIA->F.getParent());
+
+  if(!commitOutputFile.empty())
+    writeCommitServerOutput(*RootIA->F.getParent());
+
   errs() << "\n";
 
 }
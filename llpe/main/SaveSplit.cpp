@@ -215,6 +215,15 @@ void LLPEAnalysisPass::fixNonLocalUses() {
 
   }
 
+  // Committed allocations whose heap slots were reclaimed (see HeapReclaim.cpp):
+  for(std::vector<WeakVH>::iterator it = reclaimedHeapAllocations.begin(),
+	itend = reclaimedHeapAllocations.end(); it != itend; ++it) {
+
+    if(Value* V = *it)
+      forwardReferences(V, getGlobalModule());
+
+  }
+
   for(std::vector<FDGlobalState>::iterator it = fds.begin(),
 	itend = fds.end(); it != itend; ++it) {
 
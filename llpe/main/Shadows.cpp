@@ -491,7 +491,7 @@ ShadowFunctionInvar* LLPEAnalysisPass::getFunctionInvarInfo(Function& F) {
   // all loops consist of that block + L->getBlocks().size() further, contiguous blocks,
   // making is-in-loop easy to compute.
 
-  DominatorTree* thisDT = DTs[&F];
+  DominatorTree* thisDT = getDominatorTree(&F);
 
   for(LoopInfo::iterator it = LI->begin(), it2 = LI->end(); it != it2; ++it) {
     ShadowLoopInvar* newL = getLoopInfo(&RetInfo, BBIndices, *it, thisDT, 0);
@@ -616,31 +616,42 @@ ShadowBBInvar* IntegrationAttempt::getBBInvar(uint32_t idx) const {
 ShadowBB* IntegrationAttempt::createBB(uint32_t blockIdx) {
 
   release_assert((!BBs[blockIdx - BBsOffset]) && "Creating block for the second time");
-  ShadowBB* newBB = new ShadowBB();
+  BumpPtrAllocator& Arena = getShadowArena();
+  ShadowBB* newBB = new (Arena.Allocate<ShadowBB>()) ShadowBB();
   newBB->invar = &(invarInfo->BBs[blockIdx]);
   // Mark all block successors unreachable as yet.
-  newBB->succsAlive = new bool[newBB->invar->succIdxs.size()];
+  newBB->succsAlive = Arena.Allocate<bool>(newBB->invar->succIdxs.size());
   for(unsigned i = 0, ilim = newBB->invar->succIdxs.size(); i != ilim; ++i)
     newBB->succsAlive[i] = false;
   newBB->status = BBSTATUS_UNKNOWN;
   newBB->IA = this;
 
-  ShadowInstruction* insts = new ShadowInstruction[newBB->invar->insts.size()];
+  ShadowInstruction* insts = Arena.Allocate<ShadowInstruction>(newBB->invar->insts.size());
   for(uint32_t i = 0, ilim = newBB->invar->insts.size(); i != ilim; ++i) {
+    new (&insts[i]) ShadowInstruction();
     insts[i].invar = &(newBB->invar->insts[i]);
     insts[i].parent = newBB;
     insts[i].dieStatus = 0;
     insts[i].isThreadLocal = TLS_MUSTCHECK;
     insts[i].needsRuntimeCheck = RUNTIME_CHECK_NONE;
-    insts[i].typeSpecificData = 0;
   }
 
   // Create an instruction array ready for analysis.
   newBB->insts = ImmutableArray<ShadowInstruction>(insts, newBB->invar->insts.size());
+
+  newBB->instCommitData = Arena.Allocate<ShadowInstructionCommitData>(newBB->invar->insts.size());
+  for(uint32_t i = 0, ilim = newBB->invar->insts.size(); i != ilim; ++i) {
+    newBB->instCommitData[i].committedVal = 0;
+    newBB->instCommitData[i].typeSpecificData = 0;
+  }
   newBB->useSpecialVarargMerge = false;
   newBB->localStore = 0;
 
   BBs[blockIdx - BBsOffset] = newBB;
+
+  ++pass->stats.shadowBlocksAllocated;
+  pass->stats.shadowInstsAllocated += newBB->invar->insts.size();
+
   return newBB;
 
 }
@@ -651,6 +662,28 @@ ShadowBB* IntegrationAttempt::createBB(ShadowBBInvar* BBI) {
 
 }
 
+// Destroy a block created by createBB. Its memory is reclaimed along with the rest of its arena.
+void IntegrationAttempt::freeBB(ShadowBB* BB) {
+
+  BB->~ShadowBB();
+
+}
+
+// Give back the arena backing all of this context's blocks, which must already have been freed.
+void IntegrationAttempt::releaseShadowArena() {
+
+  pass->stats.shadowArenaBytes += shadowArena.getBytesAllocated();
+  shadowArena.Reset();
+
+}
+
+// Loop iterations allocate from their PeelAttempt, which releases the arena when it is deleted.
+BumpPtrAllocator& PeelIteration::getShadowArena() {
+
+  return parentPA->iterationArena;
+
+}
+
 // Get invariant information about BBs[blockidx][instidx]
 ShadowInstructionInvar* IntegrationAttempt::getInstInvar(uint32_t blockidx, uint32_t instidx) {
 
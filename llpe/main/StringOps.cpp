@@ -0,0 +1,383 @@
+//===-- StringOps.cpp -----------------------------------------------------===//
+//
+//                                  LLPE
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.txt for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Analysis/LLPE.h"
+
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+
+#include <string.h>
+
+#define DEBUG_TYPE "llpe-misc"
+
+using namespace llvm;
+
+// Native evaluation of common string and memory routines. Left to the ordinary analysis, a strlen
+// over a known buffer runs its loop a byte at a time, making a loop iteration context per byte.
+// With -llpe-native-string-calls we instead read the bytes straight out of the store and compute
+// the result here, using the host's memchr / memcmp to scan. If any argument or any byte the
+// answer depends on isn't known, the call is left to be expanded (or treated as unexpanded) as usual.
+//
+// We only read constant globals and objects no other thread can write (or anything, if the program is
+// single-threaded), since the tentative loads pass only emits checks for ordinary loads and copies.
+
+static cl::opt<bool> NativeStringCalls("llpe-native-string-calls", cl::init(false));
+
+enum stringfunctions {
+
+  STRF_STRLEN,
+  STRF_STRNLEN,
+  STRF_MEMCHR,
+  STRF_STRCHR,
+  STRF_STRCMP,
+  STRF_STRNCMP,
+  STRF_MEMCMP
+
+};
+
+struct StringFunctionDesc {
+
+  const char* name;
+  stringfunctions kind;
+  uint32_t nPtrArgs;
+  uint32_t nIntArgs;
+  bool returnsPtr;
+
+};
+
+static const StringFunctionDesc StringFunctions[] = {
+
+  { "strlen", STRF_STRLEN, 1, 0, false },
+  { "strnlen", STRF_STRNLEN, 1, 1, false },
+  { "memchr", STRF_MEMCHR, 1, 2, true },
+  { "strchr", STRF_STRCHR, 1, 1, true },
+  { "strcmp", STRF_STRCMP, 2, 0, false },
+  { "strncmp", STRF_STRNCMP, 2, 1, false },
+  { "memcmp", STRF_MEMCMP, 2, 1, false }
+
+};
+
+static DenseMap<Function*, const StringFunctionDesc*> StringFunctionMap;
+
+// Called from initSpecialFunctionsMap. Only functions with the expected signature are registered.
+void llvm::initStringFunctionsMap(Module& M) {
+
+  if(!NativeStringCalls)
+    return;
+
+  for(uint32_t i = 0, ilim = sizeof(StringFunctions) / sizeof(StringFunctionDesc); i != ilim; ++i) {
+
+    const StringFunctionDesc& Desc = StringFunctions[i];
+    Function* F = M.getFunction(Desc.name);
+    if(!F)
+      continue;
+
+    FunctionType* FT = F->getFunctionType();
+    if(FT->isVarArg() || FT->getNumParams() != Desc.nPtrArgs + Desc.nIntArgs)
+      continue;
+
+    bool typesOK = Desc.returnsPtr ? FT->getReturnType()->isPointerTy() : FT->getReturnType()->isIntegerTy();
+    for(uint32_t j = 0, jlim = FT->getNumParams(); j != jlim && typesOK; ++j) {
+      if(j < Desc.nPtrArgs)
+	typesOK = FT->getParamType(j)->isPointerTy();
+      else
+	typesOK = FT->getParamType(j)->isIntegerTy();
+    }
+
+    if(typesOK)
+      StringFunctionMap[F] = &Desc;
+
+  }
+
+}
+
+// These functions only read memory, so a call is dead once its result is unused.
+bool llvm::isStringFunction(Function* F) {
+
+  return F && StringFunctionMap.count(F);
+
+}
+
+// Get a definite pointer argument that we're allowed to read through.
+static bool getStringPointer(ShadowValue Arg, ShadowBB* BB, ImprovedVal& Ptr) {
+
+  ImprovedValSetSingle IVS;
+  if(!getImprovedValSetSingle(Arg, IVS))
+    return false;
+
+  if(IVS.isWhollyUnknown() || IVS.SetType != ValSetTypePB || IVS.Values.size() != 1)
+    return false;
+
+  Ptr = IVS.Values[0];
+  if(Ptr.Offset == LLONG_MAX || Ptr.Offset < 0)
+    return false;
+
+  if(ShadowGV* G = Ptr.V.getGV()) {
+    if(G->G->isConstant())
+      return true;
+  }
+  else if(!Ptr.V.isPtrIdx()) {
+    return false;
+  }
+
+  return GlobalIHP->programSingleThreaded || BB->localStore->es.threadLocalObjects.count(Ptr.V);
+
+}
+
+// Append to Out as many leading bytes of V[Offset : Offset + Size] as are known constants.
+static void readKnownPrefix(ShadowValue& V, uint64_t Offset, uint64_t Size, ShadowBB* BB, SmallVectorImpl<uint8_t>& Out) {
+
+  SmallVector<IVSRange, 4> Vals;
+  readValRangeMulti(V, Offset, Size, BB, Vals);
+
+  PartialVal PV(Size);
+  uint64_t known = 0;
+
+  for(SmallVector<IVSRange, 4>::iterator it = Vals.begin(), itend = Vals.end(); it != itend; ++it) {
+
+    if(it->first.first != Offset + known)
+      break;
+
+    // Never-written bytes aren't worth specialising upon.
+    const ImprovedValSetSingle& IVS = it->second;
+    if(IVS.Values.size() == 1 && IVS.Values[0].V.isVal() && isa<UndefValue>(IVS.Values[0].V.getVal()))
+      break;
+
+    uint64_t Len = it->first.second - it->first.first;
+    if(!addIVSToPartialVal(IVS, 0, known, Len, &PV, 0))
+      break;
+
+    known += Len;
+
+  }
+
+  uint8_t* Buf = (uint8_t*)PV.partialBuf;
+  Out.append(Buf, Buf + known);
+
+}
+
+// The known bytes of one object from a given pointer onwards, read from the store on demand.
+struct KnownBytes {
+
+  ImprovedVal Ptr;
+  ShadowBB* BB;
+  uint64_t Limit;
+  bool exhausted;
+  SmallVector<uint8_t, 256> Bytes;
+
+  KnownBytes(const ImprovedVal& P, ShadowBB* _BB) : Ptr(P), BB(_BB), exhausted(false) {
+
+    uint64_t ASize = BB->getAllocSize(Ptr.V);
+    Limit = (uint64_t)Ptr.Offset < ASize ? ASize - Ptr.Offset : 0;
+
+  }
+
+  uint64_t size() const {
+    return Bytes.size();
+  }
+
+  // Make at least n bytes available, reading ahead so a long scan takes few store walks.
+  bool ensure(uint64_t n) {
+
+    if(Bytes.size() >= n)
+      return true;
+    if(exhausted || n > Limit)
+      return false;
+
+    uint64_t have = Bytes.size();
+    uint64_t want = std::min(Limit, std::max(n, std::max((uint64_t)64, have * 2)));
+    readKnownPrefix(Ptr.V, Ptr.Offset + have, want - have, BB, Bytes);
+    if(Bytes.size() < want)
+      exhausted = true;
+
+    return Bytes.size() >= n;
+
+  }
+
+};
+
+// Find the first C among S's first MaxLen bytes. Pos is set to MaxLen if there is none.
+static bool scanFor(KnownBytes& S, uint8_t C, uint64_t MaxLen, uint64_t& Pos) {
+
+  uint64_t scanned = 0;
+  while(scanned < MaxLen) {
+
+    if(!S.ensure(scanned + 1))
+      return false;
+
+    uint64_t avail = std::min(S.size(), MaxLen);
+    if(const void* hit = memchr(S.Bytes.data() + scanned, C, avail - scanned)) {
+      Pos = (const uint8_t*)hit - S.Bytes.data();
+      return true;
+    }
+
+    scanned = avail;
+
+  }
+
+  Pos = MaxLen;
+  return true;
+
+}
+
+// Compare A and B over at most MaxLen bytes, also stopping after a NUL if StopAtNul.
+// Like uClibc and glibc we return the difference between the first differing bytes.
+static bool compareBytes(KnownBytes& A, KnownBytes& B, uint64_t MaxLen, bool StopAtNul, int& Result) {
+
+  uint64_t i = 0;
+  while(i < MaxLen) {
+
+    if(!(A.ensure(i + 1) && B.ensure(i + 1)))
+      return false;
+
+    uint64_t avail = std::min(std::min(A.size(), B.size()), MaxLen);
+
+    // Skip equal runs with the host memcmp unless we must look for a NUL.
+    if((!StopAtNul) && !memcmp(A.Bytes.data() + i, B.Bytes.data() + i, avail - i)) {
+      i = avail;
+      continue;
+    }
+
+    for(; i != avail; ++i) {
+
+      uint8_t a = A.Bytes[i], b = B.Bytes[i];
+      if(a != b) {
+	Result = (int)a - (int)b;
+	return true;
+      }
+      if(StopAtNul && !a) {
+	Result = 0;
+	return true;
+      }
+
+    }
+
+  }
+
+  Result = 0;
+  return true;
+
+}
+
+static void setIntResult(ImprovedValSetSingle& Result, Type* Ty, int64_t Val) {
+
+  Constant* C = ConstantInt::get(Ty, (uint64_t)Val, true);
+  Result.set(ImprovedVal(ShadowValue(C)), ValSetTypeScalar);
+
+}
+
+static void setPtrResult(ImprovedValSetSingle& Result, Type* Ty, const ImprovedVal& Base, bool Found, uint64_t Pos) {
+
+  if(Found)
+    Result.set(ImprovedVal(Base.V, Base.Offset + Pos), ValSetTypePB);
+  else
+    getImprovedValSetSingle(ShadowValue(ConstantPointerNull::get(cast<PointerType>(Ty))), Result);
+
+}
+
+// Try to compute the result of SI, a call to one of the functions above, from bytes known at
+// specialisation time. Returns false, leaving SI alone, if anything it depends upon is unknown.
+bool llvm::tryEvaluateStringCall(ShadowInstruction* SI) {
+
+  if(!inst_is<CallInst>(SI))
+    return false;
+
+  Function* F = getCalledFunction(SI);
+  if(!F)
+    return false;
+
+  DenseMap<Function*, const StringFunctionDesc*>::iterator findit = StringFunctionMap.find(F);
+  if(findit == StringFunctionMap.end())
+    return false;
+
+  const StringFunctionDesc& Desc = *findit->second;
+  ShadowBB* BB = SI->parent;
+
+  ImprovedVal Ptrs[2];
+  for(uint32_t i = 0; i != Desc.nPtrArgs; ++i) {
+    if(!getStringPointer(SI->getCallArgOperand(i), BB, Ptrs[i]))
+      return false;
+  }
+
+  uint64_t Ints[2];
+  for(uint32_t i = 0; i != Desc.nIntArgs; ++i) {
+    if(!tryGetConstantIntReplacement(SI->getCallArgOperand(Desc.nPtrArgs + i), Ints[i]))
+      return false;
+  }
+
+  KnownBytes S0(Ptrs[0], BB);
+  ImprovedValSetSingle Result;
+  Type* RetTy = SI->getType();
+  uint64_t Pos;
+  int Cmp;
+
+  switch(Desc.kind) {
+
+  case STRF_STRLEN:
+  case STRF_STRNLEN:
+    {
+      uint64_t MaxLen = Desc.kind == STRF_STRNLEN ? Ints[0] : ULLONG_MAX;
+      if(!scanFor(S0, 0, MaxLen, Pos))
+	return false;
+      setIntResult(Result, RetTy, Pos);
+      break;
+    }
+
+  case STRF_MEMCHR:
+    {
+      uint64_t MaxLen = Ints[1];
+      if(!scanFor(S0, (uint8_t)Ints[0], MaxLen, Pos))
+	return false;
+      setPtrResult(Result, RetTy, Ptrs[0], Pos != MaxLen, Pos);
+      break;
+    }
+
+  case STRF_STRCHR:
+    {
+      uint64_t Len;
+      if(!scanFor(S0, 0, ULLONG_MAX, Len))
+	return false;
+      // Searching for NUL finds the terminator.
+      const void* hit = memchr(S0.Bytes.data(), (uint8_t)Ints[0], Len + 1);
+      Pos = hit ? (const uint8_t*)hit - S0.Bytes.data() : 0;
+      setPtrResult(Result, RetTy, Ptrs[0], hit != 0, Pos);
+      break;
+    }
+
+  case STRF_STRCMP:
+  case STRF_STRNCMP:
+  case STRF_MEMCMP:
+    {
+      KnownBytes S1(Ptrs[1], BB);
+      uint64_t MaxLen = Desc.kind == STRF_STRCMP ? ULLONG_MAX : Ints[0];
+      if(!compareBytes(S0, S1, MaxLen, Desc.kind != STRF_MEMCMP, Cmp))
+	return false;
+      setIntResult(Result, RetTy, Cmp);
+      break;
+    }
+
+  }
+
+  // The result now depends on the objects we read.
+  for(uint32_t i = 0; i != Desc.nPtrArgs; ++i)
+    BB->IA->noteDependency(Ptrs[i].V);
+
+  LLVM_DEBUG(dbgs() << "Evaluated " << F->getName() << " natively\n");
+
+  if(SI->i.PB)
+    deleteIV(SI->i.PB);
+  ImprovedValSetSingle* NewIVS = newIVS();
+  *NewIVS = Result;
+  SI->i.PB = NewIVS;
+
+  ++GlobalIHP->stats.nativeStringCalls;
+  return true;
+
+}
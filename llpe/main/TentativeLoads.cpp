@@ -791,11 +791,15 @@ ShadowValue ShadowInstruction::getCopyDest() {
 
 }
 
-// Merge known-good-bytes maps at the start of block BB, by visiting its predecessor blocks.
-void llvm::doTLStoreMerge(ShadowBB* BB) {
+// Merge known-good-bytes maps at the start of block BB, by visiting its predecessor blocks
+// unless the caller has already found them.
+void llvm::doTLStoreMerge(ShadowBB* BB, ArrayRef<ShadowBB*> incomingBlocks) {
 
   TLMerger V(BB->IA, false);
-  BB->IA->visitNormalPredecessorsBW(BB, &V, /* ctx = */0);
+  if(incomingBlocks.empty())
+    BB->IA->visitNormalPredecessorsBW(BB, &V, /* ctx = */0);
+  else
+    V.setIncomingBlocks(incomingBlocks);
   V.doMerge();
 
   BB->tlStore = V.newMap;
@@ -896,6 +900,9 @@ bool IntegrationAttempt::squashUnavailableObject(ShadowInstruction& SI, const Im
 void IntegrationAttempt::squashUnavailableObjects(ShadowInstruction& SI, ImprovedValSet* PB, bool inLoopAnalyser) {
 
   if(ImprovedValSetSingle* IVS = dyn_cast_or_null<ImprovedValSetSingle>(PB)) {
+    // A compacted iteration's shared overdef set mentions nothing, and must never be written.
+    if(isSharedIVS(IVS))
+      return;
     if(squashUnavailableObject(SI, *IVS, inLoopAnalyser, SI.getOperand(0), 0, GlobalTD->getTypeStoreSize(SI.getType())))
       IVS->setOverdef();
   }
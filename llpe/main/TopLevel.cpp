@@ -17,6 +17,7 @@
 #include "llvm/IR/Dominators.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
 
 #define DEBUG_TYPE "llpe-toplevel"
@@ -31,6 +32,7 @@ using namespace llvm;
 char LLPEAnalysisPass::ID = 0;
 
 static cl::opt<std::string> RootFunctionName("llpe-root", cl::init("main"));
+static cl::opt<bool> StartupReport("llpe-startup-report");
 
 static RegisterPass<LLPEAnalysisPass> X("llpe-analysis", "LLPE Analysis",
 						 false /* Only looks at CFG */,
@@ -63,7 +65,7 @@ InlineAttempt::InlineAttempt(LLPEAnalysisPass* Pass, Function& F,
   backupTlStore = 0;
   backupDSEStore = 0;
   isStackTop = false;
-  DT = pass->DTs[&F];
+  DT = pass->getDominatorTree(&F);
   if(_CI) {
     Callers.push_back(_CI);
     uniqueParent = _CI->parent->IA;
@@ -120,6 +122,8 @@ IntegrationAttempt::~IntegrationAttempt() {
     delete (PI->second);
   }
 
+  releaseConcreteLoopResults();
+
   for(uint32_t i = 0; i < nBBs; ++i) {
 
     if(BBs[i]) {
@@ -133,13 +137,14 @@ IntegrationAttempt::~IntegrationAttempt() {
 
       }
 
-      delete BB;
+      freeBB(BB);
 
     }
 
   }
 
   delete[] BBs;
+  releaseShadowArena();
 
 }
 
@@ -190,6 +195,8 @@ PeelAttempt::~PeelAttempt() {
     delete *it;
   }
 
+  pass->stats.shadowArenaBytes += iterationArena.getBytesAllocated();
+
 }
 
 // Free all memory belonging to the pass. The specialisation contexts' destructors will take care of the real work.
@@ -199,6 +206,8 @@ void LLPEAnalysisPass::releaseMemory(void) {
     RootIA = 0;
   }
 
+  fileByteGlobals.clear();
+
   std::string command;
   raw_string_ostream ROS(command);
   ROS << "rm -rf " << ihp_workdir;
@@ -455,6 +464,28 @@ namespace llvm {
 
 // Top-level entry point:
 
+// Built the first time a function is entered: most functions in a large linked module are never
+// reached from the root, so building them all up front is wasted work.
+DominatorTree* LLPEAnalysisPass::getDominatorTree(Function* F) {
+
+  DominatorTree*& DT = DTs[F];
+  if(!DT) {
+    DT = new DominatorTree();
+    DT->recalculate(*F);
+    ++stats.dominatorTreesBuilt;
+  }
+
+  return DT;
+
+}
+
+static double msSince(std::chrono::steady_clock::time_point Start) {
+
+  std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - Start;
+  return elapsed.count();
+
+}
+
 bool LLPEAnalysisPass::runOnModule(Module& M) {
 
   if(!mkdtemp(ihp_workdir)) {
@@ -472,19 +503,22 @@ bool LLPEAnalysisPass::runOnModule(Module& M) {
   GInt32 = Type::getInt32Ty(M.getContext());
   GInt64 = Type::getInt64Ty(M.getContext());
 
-  persistPrinter = getPersistPrinter(&M);
+  // Use lists, address-taken tests and global DSE all assume every body is present, so a
+  // lazily loaded module must be read in full before we look at anything.
+  if(Error E = M.materializeAll()) {
+    errs() << "Failed to materialise module: " << toString(std::move(E)) << "\n";
+    exit(1);
+  }
 
-  initMRInfo(&M);
-  
-  for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; MI++) {
+  // Must come before anything modifies M:
+  if(lookupAnalysisCache(M))
+    return false;
 
-    if(!MI->isDeclaration()) {
-      DominatorTree* NewDT = new DominatorTree();
-      NewDT->recalculate(*MI);
-      DTs[&*MI] = NewDT;
-    }
+  persistPrinter = getPersistPrinter(&M);
 
-  }
+  std::chrono::steady_clock::time_point startupStart = std::chrono::steady_clock::now();
+
+  initMRInfo(&M);
 
   Function* FoundF = M.getFunction(RootFunctionName);
   if((!FoundF) || FoundF->isDeclaration()) {
@@ -509,12 +543,14 @@ bool LLPEAnalysisPass::runOnModule(Module& M) {
   uint32_t argvIdx = 0xffffffff;
   parseArgs(F, argConstants, argvIdx);
 
-  populateGVCaches(&M);
+  std::chrono::steady_clock::time_point globalsStart = std::chrono::steady_clock::now();
   initSpecialFunctionsMap(M);
   // Last parameter: reserve extra GV slots for the constants that path condition parsing will produce.
   initShadowGlobals(M, getStringPathConditionCount());
   initBlacklistedFunctions(M);
+  double globalsMs = msSince(globalsStart);
 
+  std::chrono::steady_clock::time_point rootStart = std::chrono::steady_clock::now();
   InlineAttempt* IA = new InlineAttempt(this, F, 0, 0);
   if(targetCallStack.size()) {
 
@@ -561,8 +597,27 @@ bool LLPEAnalysisPass::runOnModule(Module& M) {
 
   RootIA = IA;
 
+  if(StartupReport) {
+
+    uint32_t definedFunctions = 0;
+    for(Module::iterator MI = M.begin(), ME = M.end(); MI != ME; ++MI) {
+      if(!MI->isDeclaration())
+	++definedFunctions;
+    }
+
+    errs() << "Startup: " << format("%.1f", msSince(startupStart)) << " ms (globals " << format("%.1f", globalsMs) << " ms, root context "
+	   << format("%.1f", msSince(rootStart)) << " ms); " << stats.dominatorTreesBuilt << " of "
+	   << definedFunctions << " dominator trees and " << functionInfo.size() << " function descriptions built\n";
+
+  }
+
+  analysisStart = std::chrono::steady_clock::now();
+
   errs() << "Interpreting";
   IA->analyse();
+  writeMemoryReport("analysis-complete");
+  if(commitServerEnabled())
+    runCommitServer();
   IA->finaliseAndCommit(false);
   fixNonLocalUses();
   errs() << "\n";
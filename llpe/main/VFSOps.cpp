@@ -19,12 +19,14 @@
 #include "llvm/Analysis/AliasAnalysis.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/IR/CFG.h"
 #include <fcntl.h> // For O_RDONLY et al
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <string.h>
 #include <stdio.h>
 
 // This file contains functions that propagate a symbolic FD table through the program and evaluate open, read and other operations
@@ -310,9 +312,11 @@ bool IntegrationAttempt::tryPromoteOpenCall(ShadowInstruction* SI) {
 
 	if(FCalled == SysOpen) {
 
+	  // Write through our own set: the old one may be a compacted iteration's shared overdef set.
 	  if(SI->i.PB)
 	    deleteIV(SI->i.PB);
-	  SI->i.PB = newOverdefIVS();
+	  ImprovedValSetSingle* OpenResult = newOverdefIVS();
+	  SI->i.PB = OpenResult;
 
 	  uint64_t RawMode64;
 	  if(tryGetConstantIntReplacement(SI->getCallArgOperand(1), RawMode64)) {
@@ -334,7 +338,8 @@ bool IntegrationAttempt::tryPromoteOpenCall(ShadowInstruction* SI) {
 	    return true;
 	  }
 
-	  bool exists = sys::fs::exists(Filename);
+	  struct stat file_stat;
+	  bool exists = statCachedFile(Filename, &file_stat) == 0;
 	  pass->forwardableOpenCalls[SI] = new OpenStatus(Filename, exists);
 	  if(exists) {
 
@@ -345,14 +350,14 @@ bool IntegrationAttempt::tryPromoteOpenCall(ShadowInstruction* SI) {
 	      FDS->fds.resize(newId + 1);
 	    FDS->fds[newId] = FDState(Filename);
 	    
-	    cast<ImprovedValSetSingle>(SI->i.PB)->set(ImprovedVal(ShadowValue::getFdIdx(newId)), ValSetTypeFD);
+	    OpenResult->set(ImprovedVal(ShadowValue::getFdIdx(newId)), ValSetTypeFD);
 
 	    LPDEBUG("Successfully promoted open of file " << Filename << ": queueing initial forward attempt\n");
 
 	  }
 	  else {
 	    Constant* negOne = ConstantInt::get(SI->invar->I->getType(), (uint64_t)-1, true);
-	    cast<ImprovedValSetSingle>(SI->i.PB)->set(ImprovedVal(ShadowValue(negOne)), ValSetTypeScalar);
+	    OpenResult->set(ImprovedVal(ShadowValue(negOne)), ValSetTypeScalar);
 	    LPDEBUG("Open of " << Filename << " returning ENOENT\n");
 	  }
 
@@ -460,7 +465,7 @@ void llvm::noteLLIODependency(std::string& Filename) {
 bool IntegrationAttempt::executeStatCall(ShadowInstruction* SI, Function* F, std::string& Filename) {
 
   struct stat file_stat;
-  int stat_ret = ::stat(Filename.c_str(), &file_stat);
+  int stat_ret = statCachedFile(Filename, &file_stat);
 
   if(stat_ret == -1 && errno != ENOENT)
     return false;
@@ -606,7 +611,7 @@ bool IntegrationAttempt::tryResolveVFSCall(ShadowInstruction* SI) {
     case SEEK_END:
       {
 	struct stat file_stat;
-	if(::stat(FDS.filename.c_str(), &file_stat) == -1) {
+	if(statCachedFile(FDS.filename, &file_stat) == -1) {
 	  
 	  LPDEBUG("Failed to stat " << FDS.filename << "\n");
 	  return true;
@@ -661,13 +666,13 @@ bool IntegrationAttempt::tryResolveVFSCall(ShadowInstruction* SI) {
     }
 
     struct stat file_stat;
-    if(::stat(FDS.filename.c_str(), &file_stat) == -1) {
+    if(statCachedFile(FDS.filename, &file_stat) == -1) {
       LPDEBUG("Failed to stat " << FDS.filename << "\n");
       FDS.pos = (uint64_t)-1;
       return true;
     }
 
-    if(!(file_stat.st_mode & S_IFREG)) {
+    if(!S_ISREG(file_stat.st_mode)) {
       FDS.pos = (uint64_t)-1;
       return true;
     }
@@ -1037,48 +1042,111 @@ void IntegrationAttempt::tryKillAllVFSOps() {
 
 }
 
-// Read strFileName[realFilePos : realFilePos + realBytes] as an array of i8 typed Constants.
-// 'errors' will carry a verbose error report. Return true on success.
-bool llvm::getFileBytes(std::string& strFileName, uint64_t realFilePos, uint64_t realBytes, std::vector<Constant*>& arrayBytes, LLVMContext& Context, std::string& errors) {
+// Files consulted during specialisation. Each is stat'd once and, if needed, read in full (IsVolatile,
+// never mapped) once per run, so that every stat, seek, read, runtime check and lliowd hash sees the same snapshot.
+struct CachedFile {
 
-  FILE* fp = fopen(strFileName.c_str(), "r");
-  if(!fp) {
-    errors = "Couldn't open " + strFileName + ": " + strerror(errno);
-    return false;
+  int statRet;
+  int statErrno;
+  struct stat st;
+  std::unique_ptr<MemoryBuffer> Buf;
+
+};
+
+static StringMap<CachedFile> cachedFiles;
+
+static CachedFile& getCachedFile(const std::string& strFileName) {
+
+  StringMap<CachedFile>::iterator findit = cachedFiles.find(strFileName);
+  if(findit != cachedFiles.end())
+    return findit->second;
+
+  CachedFile& CF = cachedFiles[strFileName];
+  CF.statRet = ::stat(strFileName.c_str(), &CF.st);
+  CF.statErrno = CF.statRet == -1 ? errno : 0;
+  return CF;
+
+}
+
+// Every file consulted so far, whether or not it exists, for the analysis cache's dependency list.
+void llvm::getSnapshotFiles(std::vector<std::string>& Names) {
+
+  for(StringMap<CachedFile>::iterator it = cachedFiles.begin(), itend = cachedFiles.end(); it != itend; ++it)
+    Names.push_back(it->getKey().str());
+
+}
+
+// Forget every snapshot taken so far. Only safe before specialisation has looked at any file.
+void llvm::clearFileSnapshots() {
+
+  cachedFiles.clear();
+
+}
+
+// As ::stat, but answered from the per-run snapshot of strFileName.
+int llvm::statCachedFile(const std::string& strFileName, struct stat* st) {
+
+  CachedFile& CF = getCachedFile(strFileName);
+  if(CF.statRet == -1) {
+    errno = CF.statErrno;
+    return -1;
   }
 
-  int rc = fseek(fp, realFilePos, SEEK_SET);
-  if(rc == -1) {
-    errors = "Couldn't seek " + strFileName + ": " + strerror(errno);
-    return false;
+  *st = CF.st;
+  return 0;
+
+}
+
+// Get strFileName's contents. 'errors' will carry a verbose error report. Returns null on failure.
+const MemoryBuffer* llvm::getFileSnapshot(const std::string& strFileName, std::string& errors) {
+
+  CachedFile& CF = getCachedFile(strFileName);
+  if(CF.Buf)
+    return CF.Buf.get();
+
+  if(CF.statRet == -1) {
+    errors = "Couldn't stat " + strFileName + ": " + strerror(CF.statErrno);
+    return 0;
   }
 
-  uint64_t bytesRead = 0;
-  uint8_t buffer[4096];
-  Type* charType = IntegerType::get(Context, 8);
-  while(bytesRead < realBytes) {
-    uint64_t toRead = realBytes - bytesRead;
-    toRead = std::min(toRead, (uint64_t)4096);
-    size_t reallyRead = fread(buffer, 1, (size_t)toRead, fp);
-    if(reallyRead == 0) {
-      if(feof(fp))
-        break;
-      else {
-        errors = "Error reading from " + strFileName + ": " + strerror(errno);
-        fclose(fp);
-        return false;
-      }
-    }
-    for(size_t i = 0; i < reallyRead; i++) {
-      Constant* byteAsConst = ConstantInt::get(charType, buffer[i]);
-      arrayBytes.push_back(byteAsConst);
-    }
-    bytesRead += reallyRead;
+  // Read exactly the size we reported through stat, so seeks to SEEK_END agree with the content.
+  // The file is read rather than mapped (IsVolatile), since a mapping of a file that shrinks
+  // under us would fault when we touch the missing pages.
+  int64_t FileSize = S_ISREG(CF.st.st_mode) ? (int64_t)CF.st.st_size : -1;
+  ErrorOr<std::unique_ptr<MemoryBuffer> > Buf = 
+    MemoryBuffer::getFile(strFileName, FileSize, /* RequiresNullTerminator = */ false, /* IsVolatile = */ true);
+  if(!Buf) {
+    errors = "Couldn't open " + strFileName + ": " + Buf.getError().message();
+    return 0;
   }
 
-  fclose(fp);
+  // A short read is padded with zeroes; refuse the content rather than forward those.
+  struct stat after;
+  if(FileSize != -1 && (::stat(strFileName.c_str(), &after) == -1 || after.st_size != CF.st.st_size)) {
+    errors = strFileName + " changed size while being read";
+    return 0;
+  }
 
-  return true;
+  CF.Buf = std::move(*Buf);
+  return CF.Buf.get();
+
+}
+
+// Read strFileName[realFilePos : realFilePos + realBytes] as an i8 array constant, stopping early at
+// end-of-file. The constant is uniqued, so forwarding and commit share one copy of each range read.
+// 'errors' will carry a verbose error report. Returns null on failure.
+Constant* llvm::getFileBytes(std::string& strFileName, uint64_t realFilePos, uint64_t realBytes, LLVMContext& Context, std::string& errors) {
+
+  const MemoryBuffer* MB = getFileSnapshot(strFileName, errors);
+  if(!MB)
+    return 0;
+
+  uint64_t fileSize = MB->getBufferSize();
+  uint64_t available = realFilePos < fileSize ? fileSize - realFilePos : 0;
+  uint64_t n = std::min(realBytes, available);
+
+  ArrayRef<uint8_t> Bytes((const uint8_t*)MB->getBufferStart() + (n ? realFilePos : 0), n);
+  return ConstantDataArray::get(Context, Bytes);
 
 }
 
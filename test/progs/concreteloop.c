@@ -0,0 +1,35 @@
+#include <stdio.h>
+
+// Fills a table in a loop with a known trip count, then uses the table and the values the loop
+// leaves behind. Specialised with -llpe-concrete-loops (see the Makefile), so both loops are run
+// at specialisation time and the printed values must come from their recorded exit values.
+
+#define tablesize 64
+
+int main(int argc, char** argv) {
+
+  int table[tablesize];
+  int sum = 0;
+  int last = 0;
+
+  for(int i = 0; i < tablesize; ++i) {
+
+    last = (i * 7 + 3) % 31;
+    table[i] = last;
+    sum += last;
+
+  }
+
+  // Leaves by the early exit: table[19] is the first entry equal to 12.
+  int found;
+  for(found = 0; found < tablesize; ++found) {
+
+    if(table[found] == 12)
+      break;
+
+  }
+
+  printf("Sum %d, last %d, found %d, table[17] = %d\n", sum, last, found, table[17]);
+  return 0;
+
+}
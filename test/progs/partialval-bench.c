@@ -0,0 +1,43 @@
+
+#include <stdio.h>
+#include <string.h>
+
+// Microbenchmark for PartialVal byte merging (addIVSToPartialVal): build a large buffer out of many
+// small extents, then copy the whole thing around so that each forwarded copy has to gather
+// thousands of bytes from a fragmented store. Time specialisation with ../timepartialval.py.
+
+#define bufsize 8192
+#define stripe 24
+#define ncopies 16
+
+const char* pattern = "The quick brown fox jumps over the lazy dog";
+
+int main(int argc, char** argv) {
+
+	char buf[bufsize];
+	char copies[ncopies][bufsize];
+
+	// Alternate memset and memcpy stripes so that no two neighbouring extents share a source.
+	for(int i = 0; i < bufsize / stripe; ++i) {
+		if(i & 1)
+			memset(buf + (i * stripe), i, stripe);
+		else
+			memcpy(buf + (i * stripe), pattern + (i % 8), stripe);
+	}
+
+	// Leave some individual bytes written by plain stores, too.
+	for(int i = 0; i < bufsize; i += 61)
+		buf[i] = (char)i;
+
+	memcpy(copies[0], buf, bufsize);
+	for(int i = 1; i < ncopies; ++i)
+		memcpy(copies[i], copies[i - 1], bufsize);
+
+	int acc = 0;
+	for(int i = 0; i < bufsize; i += 509)
+		acc += *((int*)(copies[ncopies - 1] + i));
+
+	printf("Checksum: %d\n", acc);
+	return acc & 0xff;
+
+}
@@ -0,0 +1,63 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+// Calls each of the string functions that -llpe-native-string-calls evaluates (see the Makefile),
+// over a buffer filled by read() and over constant strings. The comparisons print their raw results,
+// so the specialised program must produce the same byte differences the C library does.
+
+static long offsetOf(const char* base, const char* p) {
+
+  return p ? p - base : -1;
+
+}
+
+int main(int argc, char** argv) {
+
+  int fd = open("read-input", O_RDONLY);
+  if(fd == -1) {
+
+    printf("Epic open fail: %s\n", strerror(errno));
+    return 1;
+
+  }
+
+  char buf[32];
+  int this_read = read(fd, buf, sizeof(buf) - 1);
+  if(this_read == -1) {
+
+    printf("Epic read fail: %s\n", strerror(errno));
+    return 1;
+
+  }
+
+  buf[this_read] = '\0';
+  close(fd);
+
+  char local[16];
+  strcpy(local, "Hello there");
+  const char* lit = "Hello world";
+
+  printf("strlen: %d %d %d\n", (int)strlen(buf), (int)strlen(local), (int)strlen(lit));
+  printf("strnlen: %d %d %d\n", (int)strnlen(buf, 0), (int)strnlen(buf, 5), (int)strnlen(local, 100));
+
+  printf("strchr: %ld %ld %ld\n", offsetOf(buf, strchr(buf, 'w')), offsetOf(buf, strchr(buf, 'z')), offsetOf(local, strchr(local, 'e')));
+  // Searching for the NUL finds the terminator, not a miss.
+  printf("strchr nul: %ld %ld\n", offsetOf(buf, strchr(buf, 0)), offsetOf(lit, strchr(lit, 0)));
+
+  printf("memchr: %ld %ld %ld\n", offsetOf(buf, memchr(buf, 'o', this_read)), offsetOf(buf, memchr(buf, 'd', 5)), offsetOf(local, memchr(local, 'r', 11)));
+  printf("memchr n=0: %ld\n", offsetOf(buf, memchr(buf, 'H', 0)));
+
+  printf("strcmp: %d %d %d %d\n", strcmp(buf, lit), strcmp(lit, local), strcmp(local, lit), strcmp(lit, "Hello world"));
+  printf("strncmp: %d %d %d\n", strncmp(buf, local, 6), strncmp(buf, local, 7), strncmp(lit, buf, 100));
+  printf("memcmp: %d %d %d\n", memcmp(buf, lit, 11), memcmp(buf, lit, 12), memcmp(local, buf, 0));
+
+  return 0;
+
+}
@@ -0,0 +1,21 @@
+#!/usr/bin/python
+
+import subprocess
+from datetime import datetime
+
+# Time specialisation of progs/partialval-bench, which spends most of its time merging
+# large fragmented buffers in addIVSToPartialVal.
+
+runs = 5
+
+subprocess.check_call(["/usr/bin/make", "-C", "progs", "partialval-bench.bc"])
+
+total = None
+for i in range(runs):
+    start_time = datetime.now()
+    subprocess.check_call(["../scripts/opt-with-mods.sh", "-loop-rotate", "-instcombine", "-jump-threading", "-loop-simplify", "-lcssa", "-integrator", "-integrator-accept-all", "progs/partialval-bench.bc", "-o", "/dev/null"])
+    elapsed = datetime.now() - start_time
+    print "Run", i, "took", elapsed
+    total = elapsed if total is None else total + elapsed
+
+print "Mean over", runs, "runs:", total / runs